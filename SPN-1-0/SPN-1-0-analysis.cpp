@@ -0,0 +1,345 @@
+/* SPN-1-0-analysis.cpp
+ *
+ * Implementation of the cryptanalysis engine for the SPN.
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#include "SPN-1-0-analysis.h"
+#include "SPN-1-0-pool.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+static inline uint64_t load_block_64(const unsigned char* b) {
+	uint64_t x = 0;
+	for (int i = BLOCK_LEN - 1; i >= 0; i--) { x = (x << 8) | b[i]; }
+	return x;
+}
+
+static inline int parity(uint64_t x) {
+	return __builtin_popcountll(x) & 1;
+}
+
+static bool by_bias(const SPN_LinearApprox& a, const SPN_LinearApprox& b) {
+	return a.bias > b.bias;
+}
+
+static bool by_prob(const SPN_Differential& a, const SPN_Differential& b) {
+	return a.prob > b.prob;
+}
+
+static bool by_score(const SPN_KeyCandidate& a, const SPN_KeyCandidate& b) {
+	return a.score > b.score;
+}
+
+void SPN_random_blocks(unsigned char out[], size_t nblocks, uint64_t seed, uint64_t first) {
+	for (size_t i = 0; i < nblocks; i++) {
+		uint64_t z = seed + (first + i + 1) * 0x9E3779B97F4A7C15ULL;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		z ^= z >> 31;
+		for (int j = 0; j < BLOCK_LEN; j++) {
+			out[i * BLOCK_LEN + j] = (unsigned char) (z >> (8 * j));
+		}
+	}
+}
+
+
+SPN_Analysis::SPN_Analysis(const SPN& cipher, int numThreads) {
+	numRounds = cipher.get_num_rounds();
+	cipher.get_sbox(sBox);
+	for (int x = 0; x < SBOX_SIZE; x++) {
+		sBoxInverse[sBox[x]] = (unsigned char) x;
+	}
+
+	// permuted[i] = input[perm[i]], so byte perm[i] ends up at i
+	unsigned char perm[BLOCK_LEN];
+	cipher.get_permutation(perm);
+	for (int i = 0; i < BLOCK_LEN; i++) {
+		dest[perm[i]] = (unsigned char) i;
+	}
+
+	lat = new int[SBOX_SIZE * SBOX_SIZE];
+	for (int a = 0; a < SBOX_SIZE; a++) {
+		for (int b = 0; b < SBOX_SIZE; b++) {
+			int count = 0;
+			for (int x = 0; x < SBOX_SIZE; x++) {
+				count += parity(a & x) == parity(b & sBox[x]);
+			}
+			lat[a * SBOX_SIZE + b] = count - SBOX_SIZE / 2;
+		}
+	}
+
+	ddt = new int[SBOX_SIZE * SBOX_SIZE]();
+	for (int a = 0; a < SBOX_SIZE; a++) {
+		for (int x = 0; x < SBOX_SIZE; x++) {
+			ddt[a * SBOX_SIZE + (sBox[x] ^ sBox[x ^ a])]++;
+		}
+	}
+
+	if (numThreads <= 0) {
+		numThreads = (int) thread::hardware_concurrency();
+	}
+	pool = new SPN_ThreadPool(numThreads > 0 ? numThreads : 1);
+}
+
+SPN_Analysis::~SPN_Analysis() {
+	delete pool;
+	delete [] lat;
+	delete [] ddt;
+}
+
+int SPN_Analysis::linear_table(int a, int b) const {
+	return lat[a * SBOX_SIZE + b];
+}
+
+int SPN_Analysis::difference_table(int a, int b) const {
+	return ddt[a * SBOX_SIZE + b];
+}
+
+/******************************************************************************
+ *                          LINEAR CRYPTANALYSIS                              *
+ ******************************************************************************
+ * A trail starting in byte s with mask a runs through the S-boxes of rounds
+ * 0 .. numRounds - 2, each one at the position pi_P() moved the byte to.
+ * For every end mask b, a dynamic program over the 256 masks of each layer
+ * keeps the start mask with the largest product of |2 * bias| (piling-up
+ * lemma: bias = 2^(n-1) * product of the n S-box biases).
+ */
+vector<SPN_LinearApprox> SPN_Analysis::find_linear_approximations(size_t perByte) const {
+	vector<SPN_LinearApprox> result;
+
+	for (int s = 0; s < BLOCK_LEN; s++) {
+		double value[SBOX_SIZE], next[SBOX_SIZE];
+		int origin[SBOX_SIZE], nextOrigin[SBOX_SIZE];
+		for (int m = 0; m < SBOX_SIZE; m++) {
+			value[m] = m == 0 ? 0 : 1;
+			origin[m] = m;
+		}
+
+		int pos = s;
+		for (int r = 0; r < numRounds - 1; r++) {
+			for (int b = 0; b < SBOX_SIZE; b++) {
+				next[b] = 0;
+				nextOrigin[b] = 0;
+			}
+			for (int a = 1; a < SBOX_SIZE; a++) {
+				if (value[a] == 0) { continue; }
+				for (int b = 1; b < SBOX_SIZE; b++) {
+					double v = value[a] * abs(lat[a * SBOX_SIZE + b]) * 2.0 / SBOX_SIZE;
+					if (v > next[b]) {
+						next[b] = v;
+						nextOrigin[b] = origin[a];
+					}
+				}
+			}
+			for (int m = 0; m < SBOX_SIZE; m++) {
+				value[m] = next[m];
+				origin[m] = nextOrigin[m];
+			}
+			pos = dest[pos];
+		}
+
+		vector<SPN_LinearApprox> lane;
+		// Approximations that always hold (or never) hold for every key guess
+		// alike, so they cannot rank anything
+		for (int b = 1; b < SBOX_SIZE; b++) {
+			if (value[b] == 0 || value[b] >= 1) { continue; }
+			SPN_LinearApprox approx;
+			approx.inMask = (uint64_t) origin[b] << (8 * s);
+			approx.inByte = s;
+			approx.outByte = pos;
+			approx.outMask = (unsigned char) b;
+			approx.bias = value[b] / 2;
+			lane.push_back(approx);
+		}
+		sort(lane.begin(), lane.end(), by_bias);
+		if (lane.size() > perByte) { lane.resize(perByte); }
+		result.insert(result.end(), lane.begin(), lane.end());
+	}
+
+	sort(result.begin(), result.end(), by_bias);
+	return result;
+}
+
+/*
+ * With a guess k for byte j of the whitening subkey, U[j] = S^-1(C[j] ^ k).
+ * The pairs only matter through (parity(inMask . P), C[j]), so each thread
+ * counts them into a 2 x 256 histogram per approximation and the histograms
+ * are merged once per chunk. Every guess is then scored from the histograms
+ * alone, without touching the pairs again.
+ */
+vector<vector<SPN_KeyCandidate> > SPN_Analysis::linear_attack(
+		const vector<SPN_LinearApprox>& approx, const unsigned char plain[],
+		const unsigned char cipher[], size_t numPairs) {
+	size_t numApprox = approx.size();
+	vector<uint64_t> hist(numApprox * 2 * SBOX_SIZE, 0);
+	mutex histMutex;
+
+	pool->parallel_for(numPairs, ANALYSIS_CHUNK_PAIRS, [&](size_t begin, size_t end) {
+		vector<uint32_t> local(numApprox * 2 * SBOX_SIZE, 0);
+		for (size_t i = begin; i < end; i++) {
+			uint64_t p = load_block_64(plain + i * BLOCK_LEN);
+			const unsigned char* c = cipher + i * BLOCK_LEN;
+			for (size_t a = 0; a < numApprox; a++) {
+				int par = parity(p & approx[a].inMask);
+				local[(a * 2 + par) * SBOX_SIZE + c[approx[a].outByte]]++;
+			}
+		}
+		lock_guard<mutex> lock(histMutex);
+		for (size_t h = 0; h < local.size(); h++) { hist[h] += local[h]; }
+	});
+
+	vector<vector<SPN_KeyCandidate> > result(BLOCK_LEN);
+	vector<double> score(BLOCK_LEN * SBOX_SIZE, 0);
+	vector<bool> attacked(BLOCK_LEN, false);
+	for (size_t a = 0; a < numApprox; a++) {
+		int j = approx[a].outByte;
+		attacked[j] = true;
+		const uint64_t* h = &hist[a * 2 * SBOX_SIZE];
+		for (int k = 0; k < SBOX_SIZE; k++) {
+			uint64_t matches = 0;
+			for (int c = 0; c < SBOX_SIZE; c++) {
+				int par = parity(approx[a].outMask & sBoxInverse[c ^ k]);
+				matches += h[par * SBOX_SIZE + c];
+			}
+			double bias = numPairs > 0 ? (double) matches / numPairs - 0.5 : 0;
+			score[j * SBOX_SIZE + k] += bias * bias;
+		}
+	}
+
+	for (int j = 0; j < BLOCK_LEN; j++) {
+		if (!attacked[j]) { continue; }
+		for (int k = 0; k < SBOX_SIZE; k++) {
+			SPN_KeyCandidate cand;
+			cand.key = (unsigned char) k;
+			cand.score = score[j * SBOX_SIZE + k];
+			result[j].push_back(cand);
+		}
+		stable_sort(result[j].begin(), result[j].end(), by_score);
+	}
+	return result;
+}
+
+/******************************************************************************
+ *                       DIFFERENTIAL CRYPTANALYSIS                           *
+ ******************************************************************************
+ * Round keys do not change differences, so every lane follows the same
+ * Markov chain over the 256 byte differences; only its position changes.
+ */
+vector<SPN_Differential> SPN_Analysis::find_differentials(size_t perByte) const {
+	vector<SPN_Differential> result;
+
+	for (int a = 1; a < SBOX_SIZE; a++) {
+		double prob[SBOX_SIZE], next[SBOX_SIZE];
+		for (int d = 0; d < SBOX_SIZE; d++) { prob[d] = d == a ? 1 : 0; }
+		for (int r = 0; r < numRounds - 1; r++) {
+			for (int b = 0; b < SBOX_SIZE; b++) { next[b] = 0; }
+			for (int d = 1; d < SBOX_SIZE; d++) {
+				if (prob[d] == 0) { continue; }
+				for (int b = 1; b < SBOX_SIZE; b++) {
+					next[b] += prob[d] * ddt[d * SBOX_SIZE + b] / SBOX_SIZE;
+				}
+			}
+			for (int b = 0; b < SBOX_SIZE; b++) { prob[b] = next[b]; }
+		}
+
+		// Differentials that always hold hold for every key guess alike
+		for (int b = 1; b < SBOX_SIZE; b++) {
+			if (prob[b] == 0 || prob[b] >= 1) { continue; }
+			SPN_Differential diff;
+			diff.inDiff = (unsigned char) a;
+			diff.outDiff = (unsigned char) b;
+			diff.prob = prob[b];
+			diff.inByte = 0;
+			diff.outByte = 0;
+			result.push_back(diff);
+		}
+	}
+	sort(result.begin(), result.end(), by_prob);
+	if (result.size() > perByte) { result.resize(perByte); }
+
+	// The same differentials for every lane
+	vector<SPN_Differential> lanes;
+	for (int s = 0; s < BLOCK_LEN; s++) {
+		int pos = s;
+		for (int r = 0; r < numRounds - 1; r++) { pos = dest[pos]; }
+		for (size_t i = 0; i < result.size(); i++) {
+			SPN_Differential diff = result[i];
+			diff.inByte = s;
+			diff.outByte = pos;
+			lanes.push_back(diff);
+		}
+	}
+	stable_sort(lanes.begin(), lanes.end(), by_prob);
+	return lanes;
+}
+
+/*
+ * Pairs only matter through the two ciphertext bytes in the attacked lane,
+ * so each chunk of pairs is tallied into a 256 x 256 histogram of
+ * (C[j], C'[j]) that is merged once per chunk. A guess k then counts the
+ * pairs with S^-1(C[j] ^ k) ^ S^-1(C'[j] ^ k) == outDiff, one histogram
+ * cell per value of C[j].
+ */
+vector<vector<SPN_KeyCandidate> > SPN_Analysis::differential_attack(SPN& oracle,
+		const vector<SPN_Differential>& diff, size_t numPairs, uint64_t seed) {
+	vector<vector<SPN_KeyCandidate> > result(BLOCK_LEN);
+	vector<double> score(BLOCK_LEN * SBOX_SIZE, 0);
+	vector<bool> attacked(BLOCK_LEN, false);
+	vector<uint64_t> hist(SBOX_SIZE * SBOX_SIZE);
+	mutex histMutex;
+
+	for (size_t d = 0; d < diff.size(); d++) {
+		const SPN_Differential& D = diff[d];
+		fill(hist.begin(), hist.end(), 0);
+
+		pool->parallel_for(numPairs, ANALYSIS_CHUNK_PAIRS, [&](size_t begin, size_t end) {
+			size_t n = end - begin;
+			vector<unsigned char> plain(2 * n * BLOCK_LEN), cipher(2 * n * BLOCK_LEN);
+			SPN_random_blocks(&plain[0], n, seed + d, begin);
+			for (size_t i = 0; i < n; i++) {
+				memcpy(&plain[(n + i) * BLOCK_LEN], &plain[i * BLOCK_LEN], BLOCK_LEN);
+				plain[(n + i) * BLOCK_LEN + D.inByte] ^= D.inDiff;
+			}
+			oracle.encrypt_blocks(&plain[0], &cipher[0], 2 * n);
+
+			vector<uint32_t> local(SBOX_SIZE * SBOX_SIZE, 0);
+			for (size_t i = 0; i < n; i++) {
+				int c0 = cipher[i * BLOCK_LEN + D.outByte];
+				int c1 = cipher[(n + i) * BLOCK_LEN + D.outByte];
+				local[c0 * SBOX_SIZE + c1]++;
+			}
+			lock_guard<mutex> lock(histMutex);
+			for (size_t h = 0; h < local.size(); h++) { hist[h] += local[h]; }
+		});
+
+		attacked[D.outByte] = true;
+		for (int k = 0; k < SBOX_SIZE; k++) {
+			// the partner of c0 is the one byte with U' = U ^ outDiff
+			uint64_t right = 0;
+			for (int c0 = 0; c0 < SBOX_SIZE; c0++) {
+				int c1 = sBox[sBoxInverse[c0 ^ k] ^ D.outDiff] ^ k;
+				right += hist[c0 * SBOX_SIZE + c1];
+			}
+			score[D.outByte * SBOX_SIZE + k] += numPairs > 0 ? (double) right / numPairs : 0;
+		}
+	}
+
+	for (int j = 0; j < BLOCK_LEN; j++) {
+		if (!attacked[j]) { continue; }
+		for (int k = 0; k < SBOX_SIZE; k++) {
+			SPN_KeyCandidate cand;
+			cand.key = (unsigned char) k;
+			cand.score = score[j * SBOX_SIZE + k];
+			result[j].push_back(cand);
+		}
+		stable_sort(result[j].begin(), result[j].end(), by_score);
+	}
+	return result;
+}
@@ -0,0 +1,113 @@
+/* SPN-1-0-analysis.h
+ *
+ * Header file of a cryptanalysis engine for the SPN, used to teach attacks on
+ * reduced-round versions of the cipher. Only the public design of the cipher
+ * (S-box, pi_P(), number of rounds) is taken from the SPN; the key is what the
+ * attacks recover.
+ *
+ * Because pi_P() moves whole bytes, a trail through the cipher keeps one
+ * active S-box per round, and the byte it ends in at the last S-box layer
+ * tells which byte of the whitening subkey it attacks.
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#ifndef __SPN_ANALYSIS__
+#define __SPN_ANALYSIS__
+
+#include <vector>
+#include "SPN-1-0.h"
+
+#define ANALYSIS_CHUNK_PAIRS (64 * 1024) // pairs per work unit of a thread
+
+using namespace std;
+
+class SPN_ThreadPool;
+
+// Linear approximation  (inMask . P) ^ (outMask . U[outByte]) = 0  where U is
+// the input of the last S-box layer
+struct SPN_LinearApprox {
+	uint64_t inMask;		// plaintext bits, byte i at bits 8i..8i+7
+	int inByte;				// byte of the plaintext the trail starts in
+	int outByte;			// byte of U the trail ends in
+	unsigned char outMask;	// bits of U[outByte]
+	double bias;			// predicted by the piling-up lemma
+};
+
+// Differential  inDiff in plaintext byte inByte -> outDiff in U[outByte]
+struct SPN_Differential {
+	int inByte;
+	unsigned char inDiff;
+	int outByte;
+	unsigned char outDiff;
+	double prob; // averaged over all round keys
+};
+
+// One guess for a byte of the whitening subkey
+struct SPN_KeyCandidate {
+	unsigned char key;
+	double score; // depends on the attack, higher is more likely
+};
+
+// Blocks first .. first + nblocks - 1 of a splitmix64 stream under seed.
+// Any range can be generated on its own, so threads can share the work.
+void SPN_random_blocks(unsigned char out[], size_t nblocks, uint64_t seed, uint64_t first);
+
+class SPN_Analysis {
+
+public:
+
+	// Engine for ciphers with the design of cipher; numThreads 0 means one
+	// per core
+	SPN_Analysis(const SPN& cipher, int numThreads = 0);
+
+	// Destructor
+	~SPN_Analysis();
+
+	// Linear approximation table of pi_S():
+	// #{x : parity(a & x) == parity(b & S(x))} - SBOX_SIZE / 2
+	int linear_table(int a, int b) const;
+
+	// The perByte best linear approximations ending in each byte of U,
+	// best first, found by searching every single-byte trail. Predictions
+	// only mean something while they are well above 1/16, the bias of a
+	// random 8-bit permutation: a lane of a strong S-box looks random after
+	// two rounds, and then the true key stands out no more than a wrong one.
+	vector<SPN_LinearApprox> find_linear_approximations(size_t perByte) const;
+
+	// Known-plaintext attack on numPairs blocks of plain[] and cipher[]. One
+	// pass over the pairs counts all approximations; the 256 guesses of each
+	// attacked byte of the whitening subkey are then ranked, best first.
+	// Result[j] is empty for bytes no approximation ends in. A guess scores
+	// the sum of its squared measured biases.
+	vector<vector<SPN_KeyCandidate> > linear_attack(const vector<SPN_LinearApprox>& approx,
+		const unsigned char plain[], const unsigned char cipher[], size_t numPairs);
+
+	// Difference distribution table of pi_S(): #{x : S(x) ^ S(x ^ a) == b}
+	int difference_table(int a, int b) const;
+
+	// The perByte most likely differentials ending in each byte of U. Since
+	// a difference stays in one byte lane, the probability over all trails
+	// is a product of the S-box's transition matrices.
+	vector<SPN_Differential> find_differentials(size_t perByte) const;
+
+	// Chosen-plaintext attack: numPairs pairs per differential, plaintexts
+	// drawn from seed, encrypted by oracle in parallel batches (so several
+	// threads call oracle.encrypt_blocks() at once; give it no pool of its
+	// own). A guess scores the summed fraction of pairs that follow its
+	// differentials.
+	vector<vector<SPN_KeyCandidate> > differential_attack(SPN& oracle,
+		const vector<SPN_Differential>& diff, size_t numPairs, uint64_t seed);
+
+private:
+
+	int numRounds;
+	unsigned char sBox[SBOX_SIZE];
+	unsigned char sBoxInverse[SBOX_SIZE];
+	unsigned char dest[BLOCK_LEN]; // pi_P() sends byte j to position dest[j]
+	int* lat; // SBOX_SIZE x SBOX_SIZE linear approximation table
+	int* ddt; // SBOX_SIZE x SBOX_SIZE difference distribution table
+	SPN_ThreadPool* pool;
+};
+
+#endif
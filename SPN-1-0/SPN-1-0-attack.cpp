@@ -0,0 +1,264 @@
+/* SPN-1-0-attack.cpp
+ *
+ * Command-line driver of the cryptanalysis engine. Builds a reduced-round SPN
+ * under a random key, generates pairs with it, runs an attack and reports how
+ * well the true whitening subkey ranks among the candidates.
+ *
+ * Usage: ./SPN-attack linear|differential|generate [--rounds N] [--pairs N]
+ *                     [--seed N] [--threads N] [--approx N] [--top N]
+ *                     [--sbox default|random|SWAPS] [--corpus FILE]
+ *
+ * --approx is the number of approximations (or differentials) per key byte.
+ * generate writes a corpus of --pairs known-plaintext pairs to FILE; linear
+ * with --corpus FILE attacks the cipher and pairs stored there instead of
+ * making its own.
+ *
+ * The default S-box (bitwise NOT) is affine, so every approximation holds
+ * with probability 0 or 1 and cannot tell key guesses apart. A random S-box
+ * is the opposite: its 8-bit lanes look like random permutations after two
+ * rounds. --sbox SWAPS (the default, 32) swaps that many random pairs of
+ * entries of the NOT S-box, a weak S-box for which the attacks visibly work.
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include "SPN-1-0.h"
+#include "SPN-1-0-analysis.h"
+#include "SPN-1-0-corpus.h"
+
+using namespace std;
+
+// Options shared by all attacks
+struct AttackOptions {
+	int rounds;
+	size_t pairs;
+	unsigned int seed;
+	int threads;
+	size_t approx; // approximations or differentials per key byte
+	size_t top;
+	int sboxSwaps; // -1 for a random S-box, 0 for the default one
+	string corpus;
+};
+
+bool parse_options(int argc, char* argv[], AttackOptions& opt);
+SPN* make_cipher(const AttackOptions& opt);
+void report_candidates(const vector<SPN_KeyCandidate>& cand, int byte,
+					   unsigned char trueKey, size_t top);
+int run_linear(const AttackOptions& opt);
+int run_differential(const AttackOptions& opt);
+int run_generate(const AttackOptions& opt);
+
+int main(int argc, char* argv[]) {
+	AttackOptions opt;
+	if (argc < 2 || !parse_options(argc, argv, opt)) {
+		cout << "Usage: " << argv[0] << " linear|differential|generate [--rounds N] [--pairs N]"
+			 << " [--seed N] [--threads N] [--approx N] [--top N]"
+			 << " [--sbox default|random|SWAPS] [--corpus FILE]" << endl;
+		return 1;
+	}
+
+	string attack(argv[1]);
+	if (attack == "linear") { return run_linear(opt); }
+	if (attack == "differential") { return run_differential(opt); }
+	if (attack == "generate") { return run_generate(opt); }
+
+	cout << "Unknown attack " << attack << endl;
+	return 1;
+}
+
+bool parse_options(int argc, char* argv[], AttackOptions& opt) {
+	opt.rounds = 4;
+	opt.pairs = 1 << 22;
+	opt.seed = 1;
+	opt.threads = 0;
+	opt.approx = 4;
+	opt.top = 5;
+	opt.sboxSwaps = 32;
+
+	for (int i = 2; i < argc; i += 2) {
+		if (i + 1 >= argc) { return false; }
+		string name(argv[i]);
+		const char* value = argv[i + 1];
+		if (name == "--rounds") { opt.rounds = atoi(value); }
+		else if (name == "--pairs") { opt.pairs = strtoull(value, NULL, 10); }
+		else if (name == "--seed") { opt.seed = (unsigned int) strtoul(value, NULL, 10); }
+		else if (name == "--threads") { opt.threads = atoi(value); }
+		else if (name == "--approx") { opt.approx = strtoull(value, NULL, 10); }
+		else if (name == "--top") { opt.top = strtoull(value, NULL, 10); }
+		else if (name == "--corpus") { opt.corpus = value; }
+		else if (name == "--sbox") {
+			if (strcmp(value, "default") == 0) { opt.sboxSwaps = 0; }
+			else if (strcmp(value, "random") == 0) { opt.sboxSwaps = -1; }
+			else { opt.sboxSwaps = atoi(value); }
+		}
+		else { return false; }
+	}
+	return opt.rounds >= 4 && opt.pairs > 0;
+}
+
+// Cipher under a key (and S-box) drawn from the seed
+SPN* make_cipher(const AttackOptions& opt) {
+	srand(opt.seed);
+	unsigned char key[KEY_LEN];
+	for (int i = 0; i < KEY_LEN; i++) { key[i] = (unsigned char) (rand() % 256); }
+	SPN* spn = new SPN(key, opt.seed, opt.rounds);
+
+	if (opt.sboxSwaps != 0) {
+		unsigned char sbox[SBOX_SIZE];
+		for (int x = 0; x < SBOX_SIZE; x++) {
+			sbox[x] = opt.sboxSwaps < 0 ? (unsigned char) x : (unsigned char) ~x;
+		}
+		// Fisher-Yates shuffle, or a few random transpositions of NOT
+		int swaps = opt.sboxSwaps < 0 ? SBOX_SIZE - 1 : opt.sboxSwaps;
+		for (int i = 0; i < swaps; i++) {
+			int x = opt.sboxSwaps < 0 ? SBOX_SIZE - 1 - i : rand() % SBOX_SIZE;
+			int y = opt.sboxSwaps < 0 ? rand() % (x + 1) : rand() % SBOX_SIZE;
+			unsigned char t = sbox[x];
+			sbox[x] = sbox[y];
+			sbox[y] = t;
+		}
+		spn->set_sbox(sbox);
+	}
+	spn->set_num_threads(opt.threads);
+	return spn;
+}
+
+// Print the best candidates of one key byte and where the true value ranks
+void report_candidates(const vector<SPN_KeyCandidate>& cand, int byte,
+					   unsigned char trueKey, size_t top) {
+	size_t rank = 0;
+	while (rank < cand.size() && cand[rank].key != trueKey) { rank++; }
+
+	cout << "  byte " << byte << ": true 0x" << hex << setw(2) << setfill('0')
+		 << (int) trueKey << dec << " ranked " << rank + 1 << " of " << cand.size() << " |";
+	for (size_t i = 0; i < top && i < cand.size(); i++) {
+		cout << " 0x" << hex << setw(2) << setfill('0') << (int) cand[i].key << dec
+			 << (cand[i].key == trueKey ? "*" : "");
+	}
+	cout << endl;
+}
+
+int run_linear(const AttackOptions& opt) {
+	SPN_Corpus corpus;
+	SPN* spn;
+	size_t numPairs = opt.pairs;
+	vector<unsigned char> own;
+	const unsigned char *plain, *cipher;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	if (!opt.corpus.empty()) {
+		if (!corpus.open(opt.corpus)) {
+			cout << "ERROR: Can't read corpus " << opt.corpus << endl;
+			return 1;
+		}
+		spn = corpus.make_cipher();
+		numPairs = (size_t) corpus.size();
+		plain = corpus.plaintexts();
+		cipher = corpus.ciphertexts();
+	}
+	else {
+		spn = make_cipher(opt);
+		own.resize(2 * numPairs * BLOCK_LEN);
+		unsigned char* p = &own[0];
+		spn->parallel_for(numPairs, ANALYSIS_CHUNK_PAIRS, [&](size_t begin, size_t end) {
+			SPN_random_blocks(p + begin * BLOCK_LEN, end - begin, opt.seed, begin);
+		});
+		spn->encrypt_blocks(p, p + numPairs * BLOCK_LEN, numPairs);
+		plain = p;
+		cipher = p + numPairs * BLOCK_LEN;
+	}
+	double genTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	SPN_Analysis analysis(*spn, opt.threads);
+	vector<SPN_LinearApprox> approx = analysis.find_linear_approximations(opt.approx);
+	cout << "Linear cryptanalysis, " << spn->get_num_rounds() << " rounds, "
+		 << approx.size() << " approximations" << endl;
+	for (size_t i = 0; i < approx.size(); i++) {
+		cout << "  in 0x" << hex << setw(16) << setfill('0') << approx[i].inMask
+			 << " -> U[" << dec << approx[i].outByte << "] & 0x" << hex << setw(2)
+			 << (int) approx[i].outMask << dec << "  bias " << approx[i].bias
+			 << "  (~" << (size_t) (8 / (approx[i].bias * approx[i].bias)) << " pairs)" << endl;
+	}
+
+	start = chrono::steady_clock::now();
+	vector<vector<SPN_KeyCandidate> > cand =
+		analysis.linear_attack(approx, plain, cipher, numPairs);
+	double attackTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	cout << numPairs << " pairs " << (opt.corpus.empty() ? "generated" : "mapped") << " in "
+		 << genTime << " s, analysed in " << attackTime << " s ("
+		 << numPairs / attackTime / 1e6 << " M pairs/s)" << endl;
+
+	unsigned char lastKey[BLOCK_LEN];
+	spn->get_subkey(spn->get_num_rounds(), lastKey);
+	cout << "Whitening subkey candidates (* = true value):" << endl;
+	for (int j = 0; j < BLOCK_LEN; j++) {
+		if (!cand[j].empty()) { report_candidates(cand[j], j, lastKey[j], opt.top); }
+	}
+
+	delete spn;
+	return 0;
+}
+
+int run_differential(const AttackOptions& opt) {
+	SPN* spn = make_cipher(opt);
+	spn->set_num_threads(1); // the engine already runs one batch per core
+	SPN_Analysis analysis(*spn, opt.threads);
+
+	vector<SPN_Differential> diff = analysis.find_differentials(opt.approx);
+	cout << "Differential cryptanalysis, " << spn->get_num_rounds() << " rounds, "
+		 << diff.size() << " differentials" << endl;
+	for (size_t i = 0; i < diff.size(); i++) {
+		cout << "  P[" << diff[i].inByte << "] ^ 0x" << hex << setw(2) << setfill('0')
+			 << (int) diff[i].inDiff << " -> U[" << dec << diff[i].outByte << "] ^ 0x"
+			 << hex << setw(2) << (int) diff[i].outDiff << dec << "  prob " << diff[i].prob
+			 << "  (~" << (size_t) (4 / diff[i].prob) << " pairs)" << endl;
+	}
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	vector<vector<SPN_KeyCandidate> > cand =
+		analysis.differential_attack(*spn, diff, opt.pairs, opt.seed);
+	double attackTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	double totalPairs = (double) opt.pairs * diff.size();
+	cout << totalPairs << " chosen-plaintext pairs generated and analysed in " << attackTime
+		 << " s (" << totalPairs / attackTime / 1e6 << " M pairs/s)" << endl;
+
+	unsigned char lastKey[BLOCK_LEN];
+	spn->get_subkey(spn->get_num_rounds(), lastKey);
+	cout << "Whitening subkey candidates (* = true value):" << endl;
+	for (int j = 0; j < BLOCK_LEN; j++) {
+		if (!cand[j].empty()) { report_candidates(cand[j], j, lastKey[j], opt.top); }
+	}
+
+	delete spn;
+	return 0;
+}
+
+int run_generate(const AttackOptions& opt) {
+	if (opt.corpus.empty()) {
+		cout << "ERROR: generate needs --corpus FILE" << endl;
+		return 1;
+	}
+	SPN* spn = make_cipher(opt);
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	bool ok = SPN_write_corpus(*spn, opt.corpus, opt.pairs, opt.seed);
+	double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	delete spn;
+
+	if (!ok) {
+		cout << "ERROR: Can't write corpus " << opt.corpus << endl;
+		return 1;
+	}
+	cout << opt.pairs << " pairs written to " << opt.corpus << " in " << elapsed << " s ("
+		 << opt.pairs / elapsed / 1e6 << " M pairs/s)" << endl;
+	return 0;
+}
@@ -0,0 +1,224 @@
+/* SPN-1-0-batch.cpp
+ *
+ * Implementation of the multi-key batch API.
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#include "SPN-1-0-batch.h"
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define BATCH_X86 1
+#include <immintrin.h>
+#endif
+
+#define BATCH_MAX_LANES 8 // blocks gathered per kernel call, the widest register
+#define BATCH_ODD_LANE 0x0808080808080808ULL // pshufb offset of the upper block of 16 bytes
+
+using namespace std;
+
+/***************************************************
+ * LANE KERNELS
+ ***************************************************
+ * Each kernel moves block src[l] to dst[l] under compiled key key[l] for
+ * as many whole registers as fit in n, and returns how many blocks it did;
+ * lanes_scalar() finishes the rest. Every lane gets its own shuffle mask:
+ * perm[key[l]] (plus 8 in each byte for the upper block of a 16-byte
+ * lane), so blocks under different keys share one pshufb. With AVX2 and
+ * AVX-512 the perm and mask words are gathered straight from the tables.
+ */
+typedef int (*BatchKernel)(const unsigned char* const src[], unsigned char* const dst[],
+	const int32_t key[], int n, const uint64_t perm[], const uint64_t mask[]);
+
+// Word with byte i of b at bits 8i..8i+7
+static inline uint64_t pack_64(const unsigned char b[BLOCK_LEN]) {
+	uint64_t x = 0;
+	for (int i = BLOCK_LEN - 1; i >= 0; i--) { x = (x << 8) | b[i]; }
+	return x;
+}
+
+static int lanes_scalar(const unsigned char* const src[], unsigned char* const dst[],
+		const int32_t key[], int n, const uint64_t perm[], const uint64_t mask[]) {
+	unsigned char tmp[BLOCK_LEN];
+	for (int l = 0; l < n; l++) {
+		uint64_t p = perm[key[l]], m = mask[key[l]];
+		for (int i = 0; i < BLOCK_LEN; i++) {
+			tmp[i] = src[l][(p >> (8 * i)) & 0xff] ^ (unsigned char) (m >> (8 * i));
+		}
+		memcpy(dst[l], tmp, BLOCK_LEN);
+	}
+	return n;
+}
+
+#if defined(BATCH_X86)
+
+static inline long long load_64(const unsigned char* b) {
+	long long x;
+	memcpy(&x, b, BLOCK_LEN);
+	return x;
+}
+
+__attribute__((target("ssse3")))
+static int lanes_ssse3(const unsigned char* const src[], unsigned char* const dst[],
+		const int32_t key[], int n, const uint64_t perm[], const uint64_t mask[]) {
+	const __m128i odd = _mm_set_epi64x((long long) BATCH_ODD_LANE, 0);
+	int l = 0;
+	for (; l + 2 <= n; l += 2) {
+		__m128i x = _mm_set_epi64x(load_64(src[l + 1]), load_64(src[l]));
+		__m128i shuf = _mm_set_epi64x((long long) perm[key[l + 1]], (long long) perm[key[l]]);
+		__m128i m = _mm_set_epi64x((long long) mask[key[l + 1]], (long long) mask[key[l]]);
+		x = _mm_xor_si128(_mm_shuffle_epi8(x, _mm_add_epi8(shuf, odd)), m);
+		_mm_storel_epi64((__m128i*) dst[l], x);
+		_mm_storel_epi64((__m128i*) dst[l + 1], _mm_unpackhi_epi64(x, x));
+	}
+	return l;
+}
+
+__attribute__((target("avx2")))
+static int lanes_avx2(const unsigned char* const src[], unsigned char* const dst[],
+		const int32_t key[], int n, const uint64_t perm[], const uint64_t mask[]) {
+	const __m256i odd = _mm256_set_epi64x((long long) BATCH_ODD_LANE, 0,
+										  (long long) BATCH_ODD_LANE, 0);
+	int l = 0;
+	for (; l + 4 <= n; l += 4) {
+		__m128i idx = _mm_loadu_si128((const __m128i*) (key + l));
+		__m256i shuf = _mm256_i32gather_epi64((const long long*) perm, idx, 8);
+		__m256i m = _mm256_i32gather_epi64((const long long*) mask, idx, 8);
+		__m256i x = _mm256_set_epi64x(load_64(src[l + 3]), load_64(src[l + 2]),
+									  load_64(src[l + 1]), load_64(src[l]));
+		x = _mm256_xor_si256(_mm256_shuffle_epi8(x, _mm256_add_epi8(shuf, odd)), m);
+		__m128i lo = _mm256_castsi256_si128(x), hi = _mm256_extracti128_si256(x, 1);
+		_mm_storel_epi64((__m128i*) dst[l], lo);
+		_mm_storel_epi64((__m128i*) dst[l + 1], _mm_unpackhi_epi64(lo, lo));
+		_mm_storel_epi64((__m128i*) dst[l + 2], hi);
+		_mm_storel_epi64((__m128i*) dst[l + 3], _mm_unpackhi_epi64(hi, hi));
+	}
+	_mm256_zeroupper(); // the caller is SSE code
+	return l;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static int lanes_avx512(const unsigned char* const src[], unsigned char* const dst[],
+		const int32_t key[], int n, const uint64_t perm[], const uint64_t mask[]) {
+	const __m512i odd = _mm512_set_epi64((long long) BATCH_ODD_LANE, 0,
+										 (long long) BATCH_ODD_LANE, 0,
+										 (long long) BATCH_ODD_LANE, 0,
+										 (long long) BATCH_ODD_LANE, 0);
+	int l = 0;
+	for (; l + 8 <= n; l += 8) {
+		__m256i idx = _mm256_loadu_si256((const __m256i*) (key + l));
+		__m512i shuf = _mm512_i32gather_epi64(idx, (const void*) perm, 8);
+		__m512i m = _mm512_i32gather_epi64(idx, (const void*) mask, 8);
+		__m512i x = _mm512_set_epi64(load_64(src[l + 7]), load_64(src[l + 6]),
+									 load_64(src[l + 5]), load_64(src[l + 4]),
+									 load_64(src[l + 3]), load_64(src[l + 2]),
+									 load_64(src[l + 1]), load_64(src[l]));
+		x = _mm512_xor_si512(_mm512_shuffle_epi8(x, _mm512_add_epi8(shuf, odd)), m);
+		long long out[8];
+		_mm512_storeu_si512((void*) out, x);
+		for (int i = 0; i < 8; i++) { memcpy(dst[l + i], &out[i], BLOCK_LEN); }
+	}
+	_mm256_zeroupper();
+	return l;
+}
+
+#endif
+
+// Kernel for the instruction set the SPN engine runs on (SPN::get_isa())
+static BatchKernel batch_kernel() {
+#if defined(BATCH_X86)
+	switch (SPN::get_isa()) {
+		case SPN_ISA_SSSE3: return lanes_ssse3;
+		case SPN_ISA_AVX2: return lanes_avx2;
+		case SPN_ISA_AVX512: return lanes_avx512;
+		default: break;
+	}
+#endif
+	return lanes_scalar;
+}
+
+
+SPN_KeyBatch::SPN_KeyBatch() {
+}
+
+int SPN_KeyBatch::add_key(SPN& spn) {
+	unsigned char p[BLOCK_LEN], m[BLOCK_LEN], pInv[BLOCK_LEN], mInv[BLOCK_LEN];
+	spn.compile_key();
+	bool ok = spn.get_compiled_key(true, p, m) && spn.get_compiled_key(false, pInv, mInv);
+	if (!ok) {
+		memset(p, 0, BLOCK_LEN);
+		memset(m, 0, BLOCK_LEN);
+		memset(pInv, 0, BLOCK_LEN);
+		memset(mInv, 0, BLOCK_LEN);
+	}
+
+	perm.push_back(pack_64(p));
+	mask.push_back(pack_64(m));
+	permInverse.push_back(pack_64(pInv));
+	maskInverse.push_back(pack_64(mInv));
+	fallback.push_back(ok ? NULL : &spn);
+	return (int) fallback.size() - 1;
+}
+
+int SPN_KeyBatch::add_key(const unsigned char k[KEY_LEN], unsigned int seed, int nr) {
+	shared_ptr<SPN> spn(new SPN(k, seed, nr));
+	int index = add_key(*spn);
+	if (fallback[index] != NULL) { owned.push_back(spn); }
+	return index;
+}
+
+int SPN_KeyBatch::size() const {
+	return (int) fallback.size();
+}
+
+bool SPN_KeyBatch::encrypt(const SPN_BatchRecord records[], size_t n) {
+	return run(records, n, true);
+}
+
+bool SPN_KeyBatch::decrypt(const SPN_BatchRecord records[], size_t n) {
+	return run(records, n, false);
+}
+
+/*
+ * Blocks of compiled keys are queued, BATCH_MAX_LANES at a time, whatever
+ * record they come from; a full queue goes through the lane kernel at once.
+ * Records of fallback keys are done on the spot by their own SPN.
+ */
+bool SPN_KeyBatch::run(const SPN_BatchRecord records[], size_t n, bool encrypt) {
+	for (size_t r = 0; r < n; r++) {
+		if (records[r].key < 0 || records[r].key >= size()) { return false; }
+	}
+
+	const uint64_t* p = encrypt ? perm.data() : permInverse.data();
+	const uint64_t* m = encrypt ? mask.data() : maskInverse.data();
+	BatchKernel kernel = batch_kernel();
+
+	const unsigned char* src[BATCH_MAX_LANES];
+	unsigned char* dst[BATCH_MAX_LANES];
+	int32_t key[BATCH_MAX_LANES];
+	int queued = 0;
+
+	for (size_t r = 0; r < n; r++) {
+		const SPN_BatchRecord& rec = records[r];
+		SPN* spn = fallback[rec.key];
+		if (spn != NULL) {
+			if (encrypt) { spn->encrypt_blocks(rec.in, rec.out, rec.nblocks); }
+			else { spn->decrypt_blocks(rec.in, rec.out, rec.nblocks); }
+			continue;
+		}
+		for (size_t b = 0; b < rec.nblocks; b++) {
+			src[queued] = rec.in + b * BLOCK_LEN;
+			dst[queued] = rec.out + b * BLOCK_LEN;
+			key[queued] = rec.key;
+			if (++queued == BATCH_MAX_LANES) {
+				int done = kernel(src, dst, key, queued, p, m);
+				lanes_scalar(src + done, dst + done, key + done, queued - done, p, m);
+				queued = 0;
+			}
+		}
+	}
+	int done = kernel(src, dst, key, queued, p, m);
+	lanes_scalar(src + done, dst + done, key + done, queued - done, p, m);
+	return true;
+}
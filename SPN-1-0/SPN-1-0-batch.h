@@ -0,0 +1,72 @@
+/* SPN-1-0-batch.h
+ *
+ * Header file of the multi-key batch API. Services that encrypt many small
+ * records, each under its own key, would otherwise call one SPN object per
+ * record and pay the per-call overhead for a block or two. SPN_KeyBatch
+ * keeps every key as its compiled form (see SPN::compile_key()) in
+ * structure-of-arrays tables of 64-bit words, 32 bytes per key, and runs
+ * blocks of different records side by side in the lanes of one SIMD
+ * register, each lane with its own permutation and mask.
+ *
+ * Keys with another S-box than the complement cannot be compiled; their
+ * records go through SPN::encrypt_blocks() one record at a time.
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#ifndef __SPN_BATCH__
+#define __SPN_BATCH__
+
+#include <vector>
+#include <memory>
+#include "SPN-1-0.h"
+
+using namespace std;
+
+// One record of a batch: nblocks whole blocks under key context key. out
+// may alias in, but not the blocks of another record.
+struct SPN_BatchRecord {
+	int key;	// index returned by SPN_KeyBatch::add_key()
+	const unsigned char* in;
+	unsigned char* out;
+	size_t nblocks;
+};
+
+class SPN_KeyBatch {
+
+public:
+
+	SPN_KeyBatch();
+
+	// Add the key context of spn and return its index. This calls
+	// compile_key() on the caller's spn, which frees its T-tables unless
+	// its kernel is SPN_KERNEL_TTABLE. A complement-S-box key is then copied
+	// into the tables, so spn may go away afterwards. Any other key is
+	// kept by reference, and spn must outlive the batch.
+	int add_key(SPN& spn);
+
+	// Add the key context of SPN(k, seed, nr). The batch keeps the object
+	// itself only if the key could not be compiled.
+	int add_key(const unsigned char k[KEY_LEN], unsigned int seed, int nr = 4);
+
+	// Number of key contexts
+	int size() const;
+
+	// Encrypt/decrypt records[0..n). Returns false, without touching any
+	// record, if one of them names an unknown key.
+	bool encrypt(const SPN_BatchRecord records[], size_t n);
+	bool decrypt(const SPN_BatchRecord records[], size_t n);
+
+private:
+
+	// Compiled keys, one word per key: byte i of perm[k] is the source byte
+	// of output byte i under key k, byte i of mask[k] is XORed into it
+	vector<uint64_t> perm, mask;
+	vector<uint64_t> permInverse, maskInverse;
+	vector<SPN*> fallback; // non-NULL for keys that could not be compiled
+	vector<shared_ptr<SPN> > owned; // fallback contexts made by the batch itself
+
+	bool run(const SPN_BatchRecord records[], size_t n, bool encrypt);
+};
+
+#endif
@@ -0,0 +1,253 @@
+/* SPN-1-0-bench.cpp
+ *
+ * Throughput benchmark of the SPN block engine. Measures MB/s, cycles/byte
+ * and time per call for every combination of operation, kernel, round
+ * count, thread count and input size, prints one JSON object per line and
+ * can compare against a stored baseline to catch regressions. The smallest
+ * size is one block, so its time per call is the single-block latency.
+ * --max-size must be at least one block.
+ *
+ * Usage: ./SPN-bench [--max-size BYTES] [--threads N,N,...] [--min-time SEC]
+ *                    [--out FILE] [--baseline FILE] [--tolerance FRACTION]
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include "SPN-1-0.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+
+using namespace std;
+
+// One benchmark result
+struct BenchResult {
+	string op, kernel;
+	int rounds, threads;
+	size_t bytes;
+	double mbPerSec, cyclesPerByte, nsPerCall;
+};
+
+struct KernelChoice {
+	const char* name;
+	SPN_Kernel kernel;
+};
+
+static const KernelChoice KERNELS[] = {
+	{"scalar", SPN_KERNEL_SCALAR},
+	{"simd", SPN_KERNEL_SIMD},
+	{"fixed", SPN_KERNEL_FIXED},
+	{"ttable", SPN_KERNEL_TTABLE},
+	{"bitslice", SPN_KERNEL_BITSLICE},
+	{"collapsed", SPN_KERNEL_COLLAPSED},
+	{"auto", SPN_KERNEL_AUTO}
+};
+static const char* OPS[] = {"encrypt", "decrypt", "ctr"};
+
+static inline unsigned long long read_cycles() {
+#ifdef HAVE_RDTSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+BenchResult run_bench(SPN& spn, const string& op, unsigned char* in, unsigned char* out,
+					  size_t bytes, double minTime);
+string to_json(const BenchResult& r);
+bool parse_json(const string& line, BenchResult& r);
+string result_id(const BenchResult& r);
+
+int main(int argc, char* argv[]) {
+	size_t maxSize = 16 * 1024 * 1024;
+	double minTime = 0.2;
+	double tolerance = 0.10;
+	string outFile, baselineFile;
+	vector<int> threadCounts;
+
+	for (int i = 1; i + 1 < argc; i += 2) {
+		string opt(argv[i]);
+		if (opt == "--max-size") { maxSize = strtoull(argv[i + 1], NULL, 10); }
+		else if (opt == "--min-time") { minTime = atof(argv[i + 1]); }
+		else if (opt == "--out") { outFile = argv[i + 1]; }
+		else if (opt == "--baseline") { baselineFile = argv[i + 1]; }
+		else if (opt == "--tolerance") { tolerance = atof(argv[i + 1]); }
+		else if (opt == "--threads") {
+			stringstream list(argv[i + 1]);
+			string item;
+			while (getline(list, item, ',')) { threadCounts.push_back(atoi(item.c_str())); }
+		}
+		else {
+			cout << "Unknown option " << opt << endl;
+			return 1;
+		}
+	}
+	if (maxSize < BLOCK_LEN) {
+		cout << "--max-size must be at least " << BLOCK_LEN << " bytes" << endl;
+		return 1;
+	}
+	if (threadCounts.empty()) {
+		threadCounts.push_back(1);
+		int cores = (int) thread::hardware_concurrency();
+		if (cores > 1) { threadCounts.push_back(cores); }
+	}
+
+	// Sizes from one block up to maxSize, x64 each step
+	vector<size_t> sizes;
+	for (size_t s = BLOCK_LEN; s <= maxSize; s *= 64) { sizes.push_back(s); }
+	size_t lastSize = maxSize / BLOCK_LEN * BLOCK_LEN; // whole blocks only
+	if (sizes.back() != lastSize) {
+		sizes.push_back(lastSize);
+	}
+
+	unsigned char* in = new unsigned char[sizes.back()];
+	unsigned char* out = new unsigned char[sizes.back()];
+	for (size_t i = 0; i < sizes.back(); i++) { in[i] = (unsigned char) (rand() % 256); }
+
+	unsigned char key[KEY_LEN];
+	for (int i = 0; i < KEY_LEN; i++) { key[i] = (unsigned char) (rand() % 256); }
+
+	ofstream json;
+	if (!outFile.empty()) { json.open(outFile.c_str()); }
+	vector<BenchResult> results;
+	int rounds[] = {4, 8, 16};
+	SPN_Isa detected = SPN::get_isa();
+
+	for (int r = 0; r < 3; r++) {
+		SPN spn(key, 1, rounds[r]);
+		spn.compile_key();
+		for (size_t t = 0; t < threadCounts.size(); t++) {
+			spn.set_num_threads(threadCounts[t]);
+			for (size_t k = 0; k < sizeof(KERNELS) / sizeof(KERNELS[0]); k++) {
+				spn.set_kernel(KERNELS[k].kernel);
+				// The SIMD kernel runs once per instruction set the CPU has
+				int isa = KERNELS[k].kernel == SPN_KERNEL_SIMD ? SPN_ISA_SSSE3 : SPN_ISA_AVX512;
+				for (; isa <= SPN_ISA_AVX512; isa++) {
+					string name(KERNELS[k].name);
+					if (KERNELS[k].kernel == SPN_KERNEL_SIMD) {
+						if (!SPN::set_isa((SPN_Isa) isa)) { continue; }
+						name += string("-") + SPN::isa_name((SPN_Isa) isa);
+					}
+					for (size_t o = 0; o < sizeof(OPS) / sizeof(OPS[0]); o++) {
+						for (size_t s = 0; s < sizes.size(); s++) {
+							BenchResult res = run_bench(spn, OPS[o], in, out, sizes[s], minTime);
+							res.kernel = name;
+							res.rounds = rounds[r];
+							res.threads = threadCounts[t];
+							results.push_back(res);
+
+							string line = to_json(res);
+							cout << line << endl;
+							if (json.is_open()) { json << line << endl; }
+						}
+					}
+				}
+				SPN::set_isa(detected);
+			}
+		}
+	}
+
+	delete [] in;
+	delete [] out;
+
+	if (baselineFile.empty()) { return 0; }
+
+	// Compare MB/s with the baseline, matching on everything but the numbers
+	ifstream baseline(baselineFile.c_str());
+	if (!baseline) {
+		cout << "ERROR: Can't open baseline " << baselineFile << endl;
+		return 1;
+	}
+	int regressions = 0;
+	string line;
+	while (getline(baseline, line)) {
+		BenchResult old;
+		if (!parse_json(line, old)) { continue; }
+		for (size_t i = 0; i < results.size(); i++) {
+			if (result_id(results[i]) != result_id(old)) { continue; }
+			if (results[i].mbPerSec < old.mbPerSec * (1.0 - tolerance)) {
+				cerr << "REGRESSION " << result_id(old) << ": " << results[i].mbPerSec
+					 << " MB/s vs baseline " << old.mbPerSec << " MB/s" << endl;
+				regressions++;
+			}
+		}
+	}
+	cerr << regressions << " regression(s) beyond " << tolerance * 100 << "%" << endl;
+	return regressions == 0 ? 0 : 2;
+}
+
+// Repeat op on bytes of input until minTime seconds have passed
+BenchResult run_bench(SPN& spn, const string& op, unsigned char* in, unsigned char* out,
+					  size_t bytes, double minTime) {
+	size_t nblocks = bytes / BLOCK_LEN;
+	unsigned long long iterations = 0;
+	double elapsed = 0;
+	unsigned long long cycles = 0;
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	unsigned long long startCycles = read_cycles();
+	do {
+		if (op == "encrypt") { spn.encrypt_blocks(in, out, nblocks); }
+		else if (op == "decrypt") { spn.decrypt_blocks(in, out, nblocks); }
+		else { spn.encrypt_CTR_mode(in, out, bytes, 1, 0, 0); }
+		iterations++;
+		elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	} while (elapsed < minTime);
+	cycles = read_cycles() - startCycles;
+
+	double total = (double) bytes * iterations;
+	BenchResult r;
+	r.op = op;
+	r.bytes = bytes;
+	r.mbPerSec = total / elapsed / 1e6;
+	r.cyclesPerByte = cycles > 0 ? cycles / total : -1;
+	r.nsPerCall = elapsed * 1e9 / iterations;
+	return r;
+}
+
+string to_json(const BenchResult& r) {
+	char buf[512];
+	snprintf(buf, sizeof(buf),
+			 "{\"op\": \"%s\", \"kernel\": \"%s\", \"rounds\": %d, \"threads\": %d, "
+			 "\"bytes\": %zu, \"mb_per_s\": %.2f, \"cycles_per_byte\": %.3f, "
+			 "\"ns_per_call\": %.2f}",
+			 r.op.c_str(), r.kernel.c_str(), r.rounds, r.threads, r.bytes,
+			 r.mbPerSec, r.cyclesPerByte, r.nsPerCall);
+	return string(buf);
+}
+
+// Read back a line written by to_json(). The timing field is left out, so
+// baselines from before ns_per_call (ns_per_block) still compare.
+bool parse_json(const string& line, BenchResult& r) {
+	char op[64], kernel[64];
+	int n = sscanf(line.c_str(),
+				   "{\"op\": \"%63[^\"]\", \"kernel\": \"%63[^\"]\", \"rounds\": %d, "
+				   "\"threads\": %d, \"bytes\": %zu, \"mb_per_s\": %lf, "
+				   "\"cycles_per_byte\": %lf",
+				   op, kernel, &r.rounds, &r.threads, &r.bytes, &r.mbPerSec,
+				   &r.cyclesPerByte);
+	if (n != 7) { return false; }
+	r.nsPerCall = -1;
+	r.op = op;
+	r.kernel = kernel;
+	return true;
+}
+
+// Everything that identifies a measurement, without the numbers
+string result_id(const BenchResult& r) {
+	ostringstream id;
+	id << r.op << "/" << r.kernel << "/r" << r.rounds << "/t" << r.threads << "/" << r.bytes << "B";
+	return id.str();
+}
@@ -0,0 +1,141 @@
+/* SPN-1-0-client.cpp
+ *
+ * Implementation of the encryption daemon's client library.
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#include "SPN-1-0-daemon.h"
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace std;
+
+static bool send_all(int fd, const unsigned char* buf, size_t len);
+static bool recv_all(int fd, unsigned char* buf, size_t len);
+
+void SPN_encode_header(const SPN_DaemonHeader& h, unsigned char buf[SPN_DAEMON_HEADER_LEN]) {
+	memset(buf, 0, SPN_DAEMON_HEADER_LEN);
+	for (int i = 0; i < 4; i++) { buf[i] = (unsigned char) (h.id >> (8 * i)); }
+	buf[4] = h.op;
+	buf[5] = h.status;
+	buf[6] = (unsigned char) h.key;
+	buf[7] = (unsigned char) (h.key >> 8);
+	for (int i = 0; i < 4; i++) { buf[8 + i] = (unsigned char) (h.length >> (8 * i)); }
+}
+
+void SPN_decode_header(const unsigned char buf[SPN_DAEMON_HEADER_LEN], SPN_DaemonHeader& h) {
+	h.id = 0;
+	h.length = 0;
+	for (int i = 3; i >= 0; i--) {
+		h.id = (h.id << 8) | buf[i];
+		h.length = (h.length << 8) | buf[8 + i];
+	}
+	h.op = buf[4];
+	h.status = buf[5];
+	h.key = (uint16_t) (buf[6] | (buf[7] << 8));
+}
+
+
+SPN_Client::SPN_Client() {
+	fd = -1;
+	nextId = 0;
+}
+
+SPN_Client::~SPN_Client() {
+	close();
+}
+
+bool SPN_Client::connect(const string& socketPath) {
+	close();
+	struct sockaddr_un addr;
+	if (socketPath.size() >= sizeof(addr.sun_path)) { return false; }
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socketPath.c_str());
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) { return false; }
+	if (::connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void SPN_Client::close() {
+	if (fd >= 0) { ::close(fd); }
+	fd = -1;
+}
+
+bool SPN_Client::encrypt_blocks(int keyId, const unsigned char in[], unsigned char out[],
+								size_t nblocks) {
+	return call(SPN_OP_ENCRYPT, keyId, in, out, nblocks);
+}
+
+bool SPN_Client::decrypt_blocks(int keyId, const unsigned char in[], unsigned char out[],
+								size_t nblocks) {
+	return call(SPN_OP_DECRYPT, keyId, in, out, nblocks);
+}
+
+bool SPN_Client::call(SPN_DaemonOp op, int keyId, const unsigned char in[],
+					  unsigned char out[], size_t nblocks) {
+	if (fd < 0 || nblocks > SPN_DAEMON_MAX_REQUEST / BLOCK_LEN || keyId < 0 || keyId > 0xffff) {
+		return false;
+	}
+
+	SPN_DaemonHeader h;
+	h.id = nextId++;
+	h.op = (unsigned char) op;
+	h.status = SPN_STATUS_OK;
+	h.key = (uint16_t) keyId;
+	h.length = (uint32_t) (nblocks * BLOCK_LEN);
+	unsigned char buf[SPN_DAEMON_HEADER_LEN];
+	SPN_encode_header(h, buf);
+	if (!send_all(fd, buf, SPN_DAEMON_HEADER_LEN) || !send_all(fd, in, h.length)) {
+		close();
+		return false;
+	}
+
+	SPN_DaemonHeader r;
+	if (!recv_all(fd, buf, SPN_DAEMON_HEADER_LEN)) {
+		close();
+		return false;
+	}
+	SPN_decode_header(buf, r);
+	if (r.id != h.id || (r.status == SPN_STATUS_OK && r.length != h.length)) {
+		close();
+		return false;
+	}
+	if (r.status != SPN_STATUS_OK) { return false; }
+	if (!recv_all(fd, out, r.length)) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+static bool send_all(int fd, const unsigned char* buf, size_t len) {
+	while (len > 0) {
+		ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) { continue; }
+		if (n <= 0) { return false; }
+		buf += n;
+		len -= (size_t) n;
+	}
+	return true;
+}
+
+static bool recv_all(int fd, unsigned char* buf, size_t len) {
+	while (len > 0) {
+		ssize_t n = recv(fd, buf, len, 0);
+		if (n < 0 && errno == EINTR) { continue; }
+		if (n <= 0) { return false; }
+		buf += n;
+		len -= (size_t) n;
+	}
+	return true;
+}
@@ -0,0 +1,192 @@
+/* SPN-1-0-corpus.cpp
+ *
+ * Implementation of binary plaintext/ciphertext corpora.
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#include "SPN-1-0-corpus.h"
+#include "SPN-1-0-analysis.h"
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+static bool write_at(int fd, const unsigned char* buf, size_t len, uint64_t offset);
+static void put_le(unsigned char* p, uint64_t v, int n);
+static uint64_t get_le(const unsigned char* p, int n);
+
+// One batch of pairs: plaintexts and their ciphertexts
+struct CorpusBatch {
+	vector<unsigned char> plain, cipher;
+	uint64_t first; // index of the first pair
+	size_t count;
+};
+
+
+bool SPN_write_corpus(SPN& spn, const string& filename, uint64_t numPairs, uint64_t seed) {
+	size_t scheduleLen = spn.schedule_size();
+	uint64_t dataOffset = (CORPUS_HEADER_LEN + scheduleLen + CORPUS_ALIGN - 1)
+		/ CORPUS_ALIGN * CORPUS_ALIGN;
+	uint64_t cipherOffset = dataOffset + numPairs * BLOCK_LEN;
+
+	int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) { return false; }
+
+	vector<unsigned char> header(dataOffset, 0);
+	memcpy(&header[0], "SPNC", 4);
+	header[4] = SPN_CORPUS_VERSION;
+	put_le(&header[8], numPairs, 8);
+	put_le(&header[16], scheduleLen, 4);
+	put_le(&header[24], dataOffset, 8);
+	spn.export_schedule(&header[CORPUS_HEADER_LEN]);
+	bool ok = write_at(fd, &header[0], header.size(), 0);
+
+	// Two batches: one is filled while the writer thread drains the other
+	CorpusBatch batches[2];
+	thread writer;
+	bool writeOk = true;
+	int cur = 0;
+	for (uint64_t first = 0; ok && first < numPairs; first += CORPUS_BATCH_PAIRS) {
+		CorpusBatch& b = batches[cur];
+		b.first = first;
+		b.count = (size_t) min((uint64_t) CORPUS_BATCH_PAIRS, numPairs - first);
+		b.plain.resize(b.count * BLOCK_LEN);
+		b.cipher.resize(b.count * BLOCK_LEN);
+
+		unsigned char* plain = &b.plain[0];
+		spn.parallel_for(b.count, ANALYSIS_CHUNK_PAIRS, [&](size_t begin, size_t end) {
+			SPN_random_blocks(plain + begin * BLOCK_LEN, end - begin, seed, first + begin);
+		});
+		spn.encrypt_blocks(plain, &b.cipher[0], b.count);
+
+		if (writer.joinable()) {
+			writer.join();
+			ok = writeOk;
+		}
+		writer = thread([&, cur]() {
+			const CorpusBatch& w = batches[cur];
+			writeOk = write_at(fd, &w.plain[0], w.count * BLOCK_LEN,
+							   dataOffset + w.first * BLOCK_LEN)
+				&& write_at(fd, &w.cipher[0], w.count * BLOCK_LEN,
+							cipherOffset + w.first * BLOCK_LEN);
+		});
+		cur ^= 1;
+	}
+	if (writer.joinable()) {
+		writer.join();
+		ok = ok && writeOk;
+	}
+
+	ok = ::close(fd) == 0 && ok;
+	return ok;
+}
+
+/******************************************************************************
+ *                               CORPUS READER                                *
+ ******************************************************************************/
+
+SPN_Corpus::SPN_Corpus() {
+	file = NULL;
+	fileLen = 0;
+	numPairs = 0;
+	scheduleLen = 0;
+	dataOffset = 0;
+}
+
+SPN_Corpus::~SPN_Corpus() {
+	close();
+}
+
+bool SPN_Corpus::open(const string& filename) {
+	close();
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) { return false; }
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t) st.st_size < CORPUS_HEADER_LEN) {
+		::close(fd);
+		return false;
+	}
+	size_t len = (size_t) st.st_size;
+	void* map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED) { return false; }
+	unsigned char* p = (unsigned char*) map;
+
+	uint64_t pairs = get_le(p + 8, 8);
+	uint64_t schedLen = get_le(p + 16, 4);
+	uint64_t offset = get_le(p + 24, 8);
+	bool ok = memcmp(p, "SPNC", 4) == 0 && p[4] == SPN_CORPUS_VERSION
+		&& offset % CORPUS_ALIGN == 0 && offset >= CORPUS_HEADER_LEN + schedLen
+		&& pairs <= (len - min((uint64_t) len, offset)) / (2 * BLOCK_LEN)
+		&& offset + pairs * 2 * BLOCK_LEN == len;
+	if (ok) {
+		SPN* spn = SPN::import_schedule(p + CORPUS_HEADER_LEN, (size_t) schedLen);
+		ok = spn != NULL;
+		delete spn;
+	}
+	if (!ok) {
+		munmap(map, len);
+		return false;
+	}
+
+	file = p;
+	fileLen = len;
+	numPairs = pairs;
+	scheduleLen = (size_t) schedLen;
+	dataOffset = (size_t) offset;
+	madvise(file + dataOffset, fileLen - dataOffset, MADV_SEQUENTIAL);
+	return true;
+}
+
+void SPN_Corpus::close() {
+	if (file != NULL) { munmap(file, fileLen); }
+	file = NULL;
+	fileLen = 0;
+	numPairs = 0;
+}
+
+uint64_t SPN_Corpus::size() const {
+	return numPairs;
+}
+
+const unsigned char* SPN_Corpus::plaintexts() const {
+	return file == NULL ? NULL : file + dataOffset;
+}
+
+const unsigned char* SPN_Corpus::ciphertexts() const {
+	return file == NULL ? NULL : file + dataOffset + numPairs * BLOCK_LEN;
+}
+
+SPN* SPN_Corpus::make_cipher() const {
+	if (file == NULL) { return NULL; }
+	return SPN::import_schedule(file + CORPUS_HEADER_LEN, scheduleLen);
+}
+
+// pwrite() until everything is written
+static bool write_at(int fd, const unsigned char* buf, size_t len, uint64_t offset) {
+	while (len > 0) {
+		ssize_t n = pwrite(fd, buf, len, (off_t) offset);
+		if (n <= 0) { return false; }
+		buf += n;
+		len -= (size_t) n;
+		offset += (uint64_t) n;
+	}
+	return true;
+}
+
+// Little-endian n-byte integers of the corpus header
+static void put_le(unsigned char* p, uint64_t v, int n) {
+	for (int i = 0; i < n; i++) { p[i] = (unsigned char) (v >> (8 * i)); }
+}
+
+static uint64_t get_le(const unsigned char* p, int n) {
+	uint64_t v = 0;
+	for (int i = 0; i < n; i++) { v |= (uint64_t) p[i] << (8 * i); }
+	return v;
+}
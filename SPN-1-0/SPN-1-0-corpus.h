@@ -0,0 +1,76 @@
+/* SPN-1-0-corpus.h
+ *
+ * Header file of binary plaintext/ciphertext corpora for statistical work on
+ * the SPN. A corpus records the cipher it was made with and stores its pairs
+ * as two block arrays, so analysis tools can map the file and hand the arrays
+ * straight to SPN_Analysis without parsing anything.
+ *
+ * File layout (integers little-endian):
+ *
+ *   0  "SPNC"          4  version       5  zero padding
+ *   8  pairs (u64)    16  schedule length (u32)     20  zero
+ *  24  data offset (u64), a multiple of CORPUS_ALIGN
+ *  32  SPN::export_schedule() blob (key, rounds, pi_P(), S-box)
+ *  data offset                        pairs plaintext blocks
+ *  data offset + pairs * BLOCK_LEN    pairs ciphertext blocks
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#ifndef __SPN_CORPUS__
+#define __SPN_CORPUS__
+
+#include <string>
+#include "SPN-1-0.h"
+
+#define SPN_CORPUS_VERSION 1 // layout version of corpus files
+#define CORPUS_HEADER_LEN 32
+#define CORPUS_ALIGN 4096 // data starts on a page, so it can be mapped on its own
+#define CORPUS_BATCH_PAIRS (1024 * 1024) // pairs generated per write, 8 MiB per array
+
+using namespace std;
+
+// Write numPairs pairs made with spn to filename. Plaintexts are blocks
+// 0 .. numPairs - 1 of the SPN_random_blocks() stream under seed; each batch
+// is generated on every core while the previous one is being written.
+// Returns false on I/O errors.
+bool SPN_write_corpus(SPN& spn, const string& filename, uint64_t numPairs, uint64_t seed);
+
+// Read-only view of a corpus file through mmap
+class SPN_Corpus {
+
+public:
+
+	SPN_Corpus();
+
+	// Destructor: unmap the file
+	~SPN_Corpus();
+
+	// Map filename; returns false if it can't be read or is not a valid corpus
+	bool open(const string& filename);
+
+	// Unmap the file, if any
+	void close();
+
+	uint64_t size() const; // number of pairs
+	const unsigned char* plaintexts() const; // size() blocks
+	const unsigned char* ciphertexts() const; // size() blocks
+
+	// The cipher the corpus was made with (delete it when done), NULL if
+	// no corpus is open
+	SPN* make_cipher() const;
+
+private:
+
+	unsigned char* file;
+	size_t fileLen;
+	uint64_t numPairs;
+	size_t scheduleLen;
+	size_t dataOffset;
+
+	// No copies: the mapping belongs to one object
+	SPN_Corpus(const SPN_Corpus&);
+	SPN_Corpus& operator=(const SPN_Corpus&);
+};
+
+#endif
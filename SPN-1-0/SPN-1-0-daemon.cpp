@@ -0,0 +1,502 @@
+/* SPN-1-0-daemon.cpp
+ *
+ * Local encryption daemon. Key contexts are loaded once from schedule blobs
+ * (SPN::export_schedule()), so clients pay neither the SPN constructor nor
+ * the single-block paths. One event loop (epoll) does all socket I/O; the
+ * requests that are complete after a wake-up are grouped by key and op, and
+ * each group runs as one encrypt_blocks()/decrypt_blocks() call over all of
+ * its blocks, which the SPN spreads over its kernel lanes and thread pool.
+ *
+ * Usage: ./SPN-daemon export <key: 32 hex digits> <seed> <rounds> <schedule out>
+ *        ./SPN-daemon serve <socket> <schedule> [<schedule> ...] [--window-ms N]
+ *
+ * Key context i of serve is the i-th schedule. Batches run one at a time, so
+ * all key contexts share one pool of worker threads, one per core.
+ * --window-ms keeps collecting
+ * requests for up to N ms after the first one of a batch, trading latency
+ * for larger batches (default 0: batch whatever arrived together).
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "SPN-1-0.h"
+#include "SPN-1-0-pool.h"
+#include "SPN-1-0-daemon.h"
+
+#define MAX_EVENTS 256
+#define READ_CHUNK (64 * 1024) // bytes read from a socket per call
+#define BATCH_BYTES (4 * 1024 * 1024) // stop collecting once a batch is this big
+#define LISTENER_ID 0 // epoll tag of the listening socket; connections count from 1
+// A connection stops being read once it holds CONN_HIGH_WATER bytes of
+// requests and answers, and is read again once fewer than CONN_LOW_WATER
+// bytes of answers are left to send. The high mark must leave room for one
+// whole request, or a connection could stall with a request half read.
+#define CONN_HIGH_WATER (2 * SPN_DAEMON_MAX_REQUEST)
+#define CONN_LOW_WATER (SPN_DAEMON_MAX_REQUEST / 4)
+
+using namespace std;
+
+// A client connection. Connections are known by id, never by fd: a closed
+// fd can come straight back from accept4() for another client while
+// requests of the old one are still in a batch.
+struct Connection {
+	uint64_t id; // unique for the life of the daemon, also the epoll tag
+	int fd;
+	vector<unsigned char> in; // received bytes not yet parsed
+	vector<unsigned char> out; // responses not yet sent
+	size_t outPos; // bytes of out already sent
+	bool closing; // stop parsing, hang up once every answer is sent
+	bool peerClosed; // the client shut down its side; no more reads
+	size_t inFlight; // requests waiting in the current batch
+	size_t inFlightBytes; // size of their answers, headers included
+	bool paused; // over CONN_HIGH_WATER; not reading until the answers drain
+	bool watchingOut; // registered for EPOLLOUT
+};
+
+// A complete request waiting for its batch. Rejected requests wait too, so
+// their error responses keep their place in the connection's order.
+struct Request {
+	uint64_t conn; // Connection::id of the sender
+	SPN_DaemonHeader header;
+	int status;
+	vector<unsigned char> data;
+};
+
+static volatile sig_atomic_t stopping = 0;
+
+bool parse_key(const char* hex, unsigned char key[KEY_LEN]);
+int run_export(int argc, char* argv[]);
+int run_serve(int argc, char* argv[]);
+SPN* load_schedule(const char* filename);
+void on_signal(int sig);
+void accept_clients(int listener, int ep, map<uint64_t, Connection>& conns, uint64_t& nextId);
+bool read_requests(Connection& c, int ep, const vector<SPN*>& keys, vector<Request>& pending,
+				   size_t& pendingBytes);
+void respond(Connection& c, const SPN_DaemonHeader& request, int status,
+			 const unsigned char* data, size_t len);
+void run_batch(vector<Request>& pending, const vector<SPN*>& keys,
+			   map<uint64_t, Connection>& conns);
+bool flush(Connection& c, int ep);
+void watch(const Connection& c, int ep);
+size_t queued_bytes(const Connection& c);
+
+int main(int argc, char* argv[]) {
+	if (argc >= 2 && strcmp(argv[1], "export") == 0) { return run_export(argc, argv); }
+	if (argc >= 2 && strcmp(argv[1], "serve") == 0) { return run_serve(argc, argv); }
+
+	cout << "Usage: " << argv[0] << " export <key: 32 hex digits> <seed> <rounds> <schedule out>" << endl;
+	cout << "       " << argv[0] << " serve <socket> <schedule> [<schedule> ...] [--window-ms N]" << endl;
+	return 1;
+}
+
+int run_export(int argc, char* argv[]) {
+	unsigned char key[KEY_LEN];
+	if (argc != 6 || !parse_key(argv[2], key)) {
+		cout << "ERROR: export needs a key of " << 2 * KEY_LEN << " hex digits, a seed,"
+			 << " a round count and an output file." << endl;
+		return 1;
+	}
+	SPN spn(key, (unsigned int) strtoul(argv[3], NULL, 10), atoi(argv[4]));
+	spn.compile_key();
+
+	vector<unsigned char> blob(spn.schedule_size());
+	spn.export_schedule(&blob[0]);
+	ofstream output(argv[5], ios::binary);
+	output.write((const char*) &blob[0], blob.size());
+	output.close();
+	if (!output) {
+		cout << "ERROR: Can't write " << argv[5] << endl;
+		return 1;
+	}
+	return 0;
+}
+
+int run_serve(int argc, char* argv[]) {
+	if (argc < 4) {
+		cout << "ERROR: serve needs a socket path and at least one schedule." << endl;
+		return 1;
+	}
+	string socketPath(argv[2]);
+	int windowMs = 0;
+	int numThreads = (int) thread::hardware_concurrency();
+	SPN_ThreadPool* pool = numThreads > 1 ? new SPN_ThreadPool(numThreads) : NULL;
+	vector<SPN*> keys;
+	for (int i = 3; i < argc; i++) {
+		if (strcmp(argv[i], "--window-ms") == 0 && i + 1 < argc) {
+			windowMs = atoi(argv[++i]);
+			continue;
+		}
+		SPN* spn = load_schedule(argv[i]);
+		if (spn == NULL) {
+			cout << "ERROR: " << argv[i] << " is not a valid schedule." << endl;
+			return 1;
+		}
+		spn->set_pool(pool);
+		keys.push_back(spn);
+	}
+
+	struct sockaddr_un addr;
+	if (socketPath.size() >= sizeof(addr.sun_path)) {
+		cout << "ERROR: Socket path too long." << endl;
+		return 1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socketPath.c_str());
+	unlink(socketPath.c_str());
+
+	int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (listener < 0 || bind(listener, (struct sockaddr*) &addr, sizeof(addr)) != 0
+		|| listen(listener, SOMAXCONN) != 0) {
+		cout << "ERROR: Can't listen on " << socketPath << endl;
+		return 1;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	int ep = epoll_create1(0);
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.u64 = LISTENER_ID;
+	epoll_ctl(ep, EPOLL_CTL_ADD, listener, &ev);
+
+	cout << "Serving " << keys.size() << " key context(s) on " << socketPath << endl;
+
+	map<uint64_t, Connection> conns;
+	uint64_t nextId = LISTENER_ID + 1;
+	vector<Request> pending;
+	struct epoll_event events[MAX_EVENTS];
+	while (!stopping) {
+		size_t pendingBytes = 0;
+		chrono::steady_clock::time_point deadline;
+		int timeout = -1;
+
+		// Collect requests: everything ready now, then (with a window) more
+		// until the window closes or the batch is big enough
+		while (!stopping) {
+			int n = epoll_wait(ep, events, MAX_EVENTS, timeout);
+			if (n < 0 && errno != EINTR) { stopping = 1; }
+			for (int e = 0; e < n; e++) {
+				uint64_t id = events[e].data.u64;
+				if (id == LISTENER_ID) {
+					accept_clients(listener, ep, conns, nextId);
+					continue;
+				}
+				map<uint64_t, Connection>::iterator it = conns.find(id);
+				if (it == conns.end()) { continue; }
+				bool alive = true;
+				if (events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+					alive = read_requests(it->second, ep, keys, pending, pendingBytes);
+				}
+				if (alive && (events[e].events & EPOLLOUT)) {
+					alive = flush(it->second, ep);
+				}
+				if (!alive) {
+					::close(it->second.fd);
+					conns.erase(it);
+				}
+			}
+
+			if (pending.empty()) {
+				timeout = -1;
+				continue;
+			}
+			if (windowMs <= 0 || pendingBytes >= BATCH_BYTES) { break; }
+			if (timeout < 0) {
+				deadline = chrono::steady_clock::now() + chrono::milliseconds(windowMs);
+			}
+			long left = (long) chrono::duration_cast<chrono::milliseconds>(
+				deadline - chrono::steady_clock::now()).count();
+			if (left <= 0) { break; }
+			timeout = (int) left;
+		}
+
+		run_batch(pending, keys, conns);
+		pending.clear();
+
+		// Send what can be sent now; the rest waits for EPOLLOUT
+		for (map<uint64_t, Connection>::iterator it = conns.begin(); it != conns.end(); ) {
+			bool idle = it->second.out.empty() && !it->second.closing;
+			if (!idle && !flush(it->second, ep)) {
+				::close(it->second.fd);
+				conns.erase(it++);
+			}
+			else {
+				++it;
+			}
+		}
+	}
+
+	for (map<uint64_t, Connection>::iterator it = conns.begin(); it != conns.end(); ++it) {
+		::close(it->second.fd);
+	}
+	::close(listener);
+	::close(ep);
+	unlink(socketPath.c_str());
+	for (size_t i = 0; i < keys.size(); i++) { delete keys[i]; }
+	delete pool;
+	return 0;
+}
+
+// Schedule blob from a file, as an SPN; NULL if unreadable or invalid
+SPN* load_schedule(const char* filename) {
+	ifstream input(filename, ios::binary);
+	if (!input) { return NULL; }
+	vector<unsigned char> blob((istreambuf_iterator<char>(input)), istreambuf_iterator<char>());
+	if (blob.empty()) { return NULL; }
+	return SPN::import_schedule(&blob[0], blob.size());
+}
+
+void on_signal(int) {
+	stopping = 1;
+}
+
+void accept_clients(int listener, int ep, map<uint64_t, Connection>& conns, uint64_t& nextId) {
+	for (;;) {
+		int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK);
+		if (fd < 0) { return; }
+		uint64_t id = nextId++;
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.u64 = id;
+		epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+		Connection& c = conns[id];
+		c.id = id;
+		c.fd = fd;
+		c.outPos = 0;
+		c.closing = false;
+		c.peerClosed = false;
+		c.inFlight = 0;
+		c.inFlightBytes = 0;
+		c.paused = false;
+		c.watchingOut = false;
+	}
+}
+
+/*
+ * Read everything available on c and move its complete requests to pending.
+ * A client may shut down its sending side and wait for the answers: at end
+ * of file the requests already buffered are still parsed, the connection
+ * stops reading and hangs up once they are answered. A client that sends
+ * faster than it reads its answers is paused at CONN_HIGH_WATER. Returns
+ * false if the connection is gone, or has nothing left to answer.
+ */
+bool read_requests(Connection& c, int ep, const vector<SPN*>& keys, vector<Request>& pending,
+				   size_t& pendingBytes) {
+	// Not reading any more, so this is a hang-up or an error: nobody is
+	// left to take the answers
+	if (c.peerClosed || c.paused) { return false; }
+
+	unsigned char buf[READ_CHUNK];
+	while (c.in.size() + queued_bytes(c) < CONN_HIGH_WATER) {
+		ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+		if (n > 0) {
+			c.in.insert(c.in.end(), buf, buf + n);
+			continue;
+		}
+		if (n == 0) {
+			c.peerClosed = true;
+			break;
+		}
+		if (errno == EINTR) { continue; }
+		if (errno == EAGAIN || errno == EWOULDBLOCK) { break; }
+		return false;
+	}
+
+	size_t pos = 0;
+	while (!c.closing && c.in.size() - pos >= SPN_DAEMON_HEADER_LEN) {
+		Request r;
+		r.conn = c.id;
+		r.status = SPN_STATUS_OK;
+		SPN_decode_header(&c.in[pos], r.header);
+		const SPN_DaemonHeader& h = r.header;
+
+		if ((h.op != SPN_OP_ENCRYPT && h.op != SPN_OP_DECRYPT)
+			|| h.length % BLOCK_LEN != 0 || h.length > SPN_DAEMON_MAX_REQUEST) {
+			r.status = SPN_STATUS_BAD_REQUEST;
+			c.closing = true;
+			c.inFlight++;
+			c.inFlightBytes += SPN_DAEMON_HEADER_LEN;
+			pending.push_back(r);
+			break;
+		}
+		if (c.in.size() - pos - SPN_DAEMON_HEADER_LEN < h.length) { break; }
+
+		const unsigned char* data = &c.in[pos + SPN_DAEMON_HEADER_LEN];
+		pos += SPN_DAEMON_HEADER_LEN + h.length;
+		if (h.key >= keys.size()) {
+			r.status = SPN_STATUS_BAD_KEY;
+		}
+		else {
+			r.data.assign(data, data + h.length);
+			pendingBytes += h.length;
+		}
+		c.inFlight++;
+		c.inFlightBytes += SPN_DAEMON_HEADER_LEN + r.data.size();
+		pending.push_back(r);
+	}
+	c.in.erase(c.in.begin(), c.in.begin() + pos);
+
+	if (!c.peerClosed && c.in.size() + queued_bytes(c) >= CONN_HIGH_WATER) {
+		c.paused = true;
+		watch(c, ep);
+	}
+
+	// A partial request at end of file can never complete
+	if (c.peerClosed) {
+		c.closing = true;
+		c.in.clear();
+		watch(c, ep);
+		return c.inFlight > 0 || c.outPos < c.out.size();
+	}
+	return true;
+}
+
+// Queue a response on c
+void respond(Connection& c, const SPN_DaemonHeader& request, int status,
+			 const unsigned char* data, size_t len) {
+	SPN_DaemonHeader h = request;
+	h.status = (unsigned char) status;
+	h.length = (uint32_t) len;
+	unsigned char buf[SPN_DAEMON_HEADER_LEN];
+	SPN_encode_header(h, buf);
+	c.out.insert(c.out.end(), buf, buf + SPN_DAEMON_HEADER_LEN);
+	if (len > 0) { c.out.insert(c.out.end(), data, data + len); }
+}
+
+/*
+ * Requests of the same key and op are copied into one buffer and run
+ * through a single kernel call; a lone request runs in place. Responses
+ * are queued in arrival order, so each connection sees its answers in the
+ * order it asked.
+ */
+void run_batch(vector<Request>& pending, const vector<SPN*>& keys,
+			   map<uint64_t, Connection>& conns) {
+	map<pair<int, int>, vector<Request*> > groups;
+	for (size_t i = 0; i < pending.size(); i++) {
+		if (pending[i].status != SPN_STATUS_OK) { continue; }
+		groups[make_pair((int) pending[i].header.key, (int) pending[i].header.op)].push_back(&pending[i]);
+	}
+
+	vector<unsigned char> batch;
+	for (map<pair<int, int>, vector<Request*> >::iterator g = groups.begin(); g != groups.end(); ++g) {
+		SPN* spn = keys[g->first.first];
+		bool encrypt = g->first.second == SPN_OP_ENCRYPT;
+		vector<Request*>& reqs = g->second;
+
+		if (reqs.size() == 1) {
+			unsigned char* data = reqs[0]->data.empty() ? NULL : &reqs[0]->data[0];
+			size_t nblocks = reqs[0]->data.size() / BLOCK_LEN;
+			if (encrypt) { spn->encrypt_blocks(data, data, nblocks); }
+			else { spn->decrypt_blocks(data, data, nblocks); }
+			continue;
+		}
+
+		batch.clear();
+		for (size_t i = 0; i < reqs.size(); i++) {
+			batch.insert(batch.end(), reqs[i]->data.begin(), reqs[i]->data.end());
+		}
+		if (!batch.empty()) {
+			if (encrypt) { spn->encrypt_blocks(&batch[0], &batch[0], batch.size() / BLOCK_LEN); }
+			else { spn->decrypt_blocks(&batch[0], &batch[0], batch.size() / BLOCK_LEN); }
+		}
+		size_t pos = 0;
+		for (size_t i = 0; i < reqs.size(); i++) {
+			copy(batch.begin() + pos, batch.begin() + pos + reqs[i]->data.size(),
+				 reqs[i]->data.begin());
+			pos += reqs[i]->data.size();
+		}
+	}
+
+	for (size_t i = 0; i < pending.size(); i++) {
+		map<uint64_t, Connection>::iterator it = conns.find(pending[i].conn);
+		if (it == conns.end()) { continue; } // hung up meanwhile
+		const vector<unsigned char>& data = pending[i].data;
+		it->second.inFlight--;
+		it->second.inFlightBytes -= SPN_DAEMON_HEADER_LEN + data.size();
+		respond(it->second, pending[i].header, pending[i].status,
+				data.empty() ? NULL : &data[0], data.size());
+	}
+}
+
+// Send as much of c.out as the socket takes and watch for EPOLLOUT while
+// something is left; resume reading a paused connection once its answers
+// are below CONN_LOW_WATER. Returns false if the connection should be closed.
+bool flush(Connection& c, int ep) {
+	while (c.outPos < c.out.size()) {
+		ssize_t n = send(c.fd, &c.out[c.outPos], c.out.size() - c.outPos, MSG_NOSIGNAL);
+		if (n > 0) {
+			c.outPos += (size_t) n;
+			continue;
+		}
+		if (n < 0 && errno == EINTR) { continue; }
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) { break; }
+		return false;
+	}
+
+	bool done = c.outPos == c.out.size();
+	if (done) {
+		c.out.clear();
+		c.outPos = 0;
+		if (c.closing && c.inFlight == 0) { return false; }
+	}
+	else if (c.outPos >= c.out.size() / 2) {
+		// Answers keep being appended while a slow reader catches up, so
+		// drop the sent part before it outgrows the unsent one
+		c.out.erase(c.out.begin(), c.out.begin() + c.outPos);
+		c.outPos = 0;
+	}
+	bool rewatch = c.watchingOut == done;
+	c.watchingOut = !done;
+	if (c.paused && queued_bytes(c) < CONN_LOW_WATER) {
+		c.paused = false;
+		rewatch = true;
+	}
+	if (rewatch) { watch(c, ep); }
+	return true;
+}
+
+// Register the events c waits for: input until the client shuts down its
+// side (and not while paused), output while answers are stuck
+void watch(const Connection& c, int ep) {
+	struct epoll_event ev;
+	ev.events = 0;
+	if (!c.peerClosed && !c.paused) { ev.events |= EPOLLIN; }
+	if (c.watchingOut) { ev.events |= EPOLLOUT; }
+	ev.data.u64 = c.id;
+	epoll_ctl(ep, EPOLL_CTL_MOD, c.fd, &ev);
+}
+
+// Answers c still owes or has not sent yet: those of its requests in the
+// current batch, and the unsent part of out
+size_t queued_bytes(const Connection& c) {
+	return c.inFlightBytes + (c.out.size() - c.outPos);
+}
+
+// 32 hex digits to KEY_LEN bytes
+bool parse_key(const char* hex, unsigned char key[KEY_LEN]) {
+	if (strlen(hex) != 2 * KEY_LEN) { return false; }
+	for (int i = 0; i < KEY_LEN; i++) {
+		char byte[3] = {hex[2 * i], hex[2 * i + 1], '\0'};
+		char* end;
+		key[i] = (unsigned char) strtoul(byte, &end, 16);
+		if (*end != '\0') { return false; }
+	}
+	return true;
+}
@@ -0,0 +1,89 @@
+/* SPN-1-0-daemon.h
+ *
+ * Header file of the local encryption daemon's protocol and client library.
+ * The daemon (SPN-1-0-daemon.cpp) holds key contexts loaded from schedule
+ * blobs and serves encrypt/decrypt requests over a Unix domain socket; small
+ * requests that arrive together are run as one batch through the block
+ * kernel. Requests on one connection are answered in order.
+ *
+ * Every message is a header followed by length bytes of blocks. Header
+ * fields, little-endian:
+ *
+ *   0  id (u32), echoed in the response
+ *   4  op (SPN_DaemonOp)      5  status (SPN_DaemonStatus, responses only)
+ *   6  key context (u16), the index of the schedule on the daemon's command line
+ *   8  length (u32), a multiple of BLOCK_LEN, at most SPN_DAEMON_MAX_REQUEST
+ *  12  zero
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#ifndef __SPN_DAEMON__
+#define __SPN_DAEMON__
+
+#include <string>
+#include "SPN-1-0.h"
+
+#define SPN_DAEMON_HEADER_LEN 16
+#define SPN_DAEMON_MAX_REQUEST (16 * 1024 * 1024) // bytes of blocks per request
+
+using namespace std;
+
+enum SPN_DaemonOp {
+	SPN_OP_ENCRYPT = 1,	// ECB encryption of whole blocks
+	SPN_OP_DECRYPT = 2	// ECB decryption of whole blocks
+};
+
+enum SPN_DaemonStatus {
+	SPN_STATUS_OK,
+	SPN_STATUS_BAD_KEY,		// no key context with that index
+	SPN_STATUS_BAD_REQUEST	// unknown op or bad length; the daemon hangs up
+};
+
+struct SPN_DaemonHeader {
+	uint32_t id;
+	unsigned char op, status;
+	uint16_t key;
+	uint32_t length;
+};
+
+// Header to and from its SPN_DAEMON_HEADER_LEN bytes on the wire
+void SPN_encode_header(const SPN_DaemonHeader& h, unsigned char buf[SPN_DAEMON_HEADER_LEN]);
+void SPN_decode_header(const unsigned char buf[SPN_DAEMON_HEADER_LEN], SPN_DaemonHeader& h);
+
+// Blocking client of the daemon; one request in flight per client, so
+// threads that want concurrency use one client each
+class SPN_Client {
+
+public:
+
+	SPN_Client();
+
+	// Destructor: hang up
+	~SPN_Client();
+
+	// Connect to the daemon listening on socketPath
+	bool connect(const string& socketPath);
+
+	// Hang up, if connected
+	void close();
+
+	// Encrypt/decrypt nblocks blocks under key context keyId. Returns false
+	// on a bad key, a request too large, or a broken connection.
+	bool encrypt_blocks(int keyId, const unsigned char in[], unsigned char out[], size_t nblocks);
+	bool decrypt_blocks(int keyId, const unsigned char in[], unsigned char out[], size_t nblocks);
+
+private:
+
+	int fd;
+	uint32_t nextId;
+
+	bool call(SPN_DaemonOp op, int keyId, const unsigned char in[],
+			  unsigned char out[], size_t nblocks);
+
+	// No copies: the connection belongs to one object
+	SPN_Client(const SPN_Client&);
+	SPN_Client& operator=(const SPN_Client&);
+};
+
+#endif
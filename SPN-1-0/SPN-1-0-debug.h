@@ -1,76 +1,67 @@
 /* SPN-1-0-debug.h
  *
  * Header file of a simple substitution-permutation network. DEBUG version that dumps out intermediate values.
+ * It is the same cipher as SPN with a tracer attached, so there is only one implementation to maintain.
  *
  * Created by Khoa Nguyen on 03/16/2016.
  */
 
-#ifndef __SPN-DEBUG__
-#define __SPN-DEBUG__
+#ifndef __SPN_DEBUG__
+#define __SPN_DEBUG__
 
 #include <iostream>
-#include <string>
+#include <sstream>
+#include "SPN-1-0.h"
 
 using namespace std;
 
-#define KEY_LEN 16
-#define KEY_RANGE 256
-#define BLOCK_LEN 8 // 8 bytes = 64 bits, the usual block length of modern block ciphers.
-#define PERMUTATION_ENCRYPT_MODE true
-#define PERMUTATION_DECRYPT_MODE false
+// Tracer that formats intermediate values into a buffer; flush() writes them out
+class SPN_StreamTracer : public SPN_Tracer {
 
-class SPN_Debug {
+public:
+
+	SPN_StreamTracer(ostream& os);
+
+	void begin_block(bool encrypt);
+	void trace(const char* stage, int r, const unsigned char block[BLOCK_LEN]);
+
+	// Write the buffered text to the output stream and restart block numbering
+	void flush();
+
+private:
+
+	ostream& out;
+	ostringstream buffer;
+	int numBlock; // blocks seen since the last flush()
+	bool encrypting; // direction of the current block, decides where a round ends
+};
+
+class SPN_Debug : public SPN {
 
 public:
 
 	// Default constructor: Random key, min# of rounds = 4
 	SPN_Debug(int nr = 4);
-	
-	// Destructor
-	~SPN_Debug();
 
-	// Encryption for a string input
+	// Encryption for a string input, dumping every intermediate value
 	unsigned char* encrypt_ECB_mode(const unsigned char plaintext[], int len);
 
-	// Decryption for an array of ciphertext characters
+	// Decryption for an array of ciphertext characters, dumping every intermediate value
 	unsigned char* decrypt_ECB_mode(const unsigned char ciphertext[], int len);
 
-	// print an unsigned char array as hexadecimal values
-	void printArray(const unsigned char in[], int len);
-
-	// Input processor: Turn string input into a 2D array of BLOCK_LEN substrings
-	void prepare_string_ECB_mode(const unsigned char input[],
-						unsigned char in[][BLOCK_LEN], int len);
+	// The PKCS#7 versions (see SPN::encrypt_ECB_mode()), dumping every intermediate value
+	unsigned char* encrypt_ECB_mode(const unsigned char plaintext[], int len, int& outLen);
+	unsigned char* decrypt_ECB_mode(const unsigned char ciphertext[], int len, int& outLen);
 
 private:
-	
-	int numRounds;	
-	unsigned char* key; // default length = KEY_LEN
-	unsigned char** subkeys; // there are (numRounds + 1) subkeys of length KEY_LEN
-	int pMatrix[BLOCK_LEN][BLOCK_LEN]; // matrix for pi_P()
-	int pMatrixInverse[BLOCK_LEN][BLOCK_LEN]; // inverse matrix of pi_P()
-	
-	// Key schedule: populate 2-D array subkeys from key
-	void generate_subkeys();
-
-	// XOR operation with key materials
-	void operation_XOR(const unsigned char* input, unsigned char XORed[],
-		int numSubkey);
-	
-	// Substitution pi_S()
-	void pi_S(const unsigned char* input, unsigned char substituted[]);
-
-	// Permutation pi_P()
-	void pi_P(const unsigned char* input, unsigned char permuted[], bool encrypt);
-
-	// Permutation matrix generator for pi_P()
-	void generate_permutation_matrix();
-
-	// Encrypt Algorithm
-	unsigned char* SPN_encrypt(const unsigned char in[BLOCK_LEN]);
-
-	// Decrypt Algorithm
-	unsigned char* SPN_decrypt(const unsigned char in[BLOCK_LEN]);
+
+	SPN_StreamTracer sink;
+
+	// Print the traced rounds, then both sides of the call
+	void print_encryption(const unsigned char plaintext[], int len,
+						  const unsigned char ciphertext[], int cipherLen);
+	void print_decryption(const unsigned char ciphertext[], int len,
+						  const unsigned char plaintext[], int plainLen);
 };
 
 #endif
@@ -0,0 +1,169 @@
+/* SPN-1-0-file.cpp
+ *
+ * Command-line tool that encrypts or decrypts a file of any size in fixed
+ * memory with SPN_Stream. Reading, ciphering and writing run on separate
+ * threads with a small ring of buffers, so disk and CPU overlap.
+ *
+ * Usage: ./SPN-file enc|dec <key: 32 hex digits> <seed> <rounds> <in> <out>
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include "SPN-1-0.h"
+#include "SPN-1-0-stream.h"
+
+#define FILE_CHUNK (4 * 1024 * 1024) // bytes read per buffer
+#define NUM_BUFFERS 3 // one being read, one being ciphered, one being written
+
+using namespace std;
+
+// A buffer of the ring: plain input and ciphered output
+struct FileBuffer {
+	unsigned char* in;
+	unsigned char* out;
+	size_t inLen, outLen;
+	bool last; // end of input reached
+};
+
+// Blocking queue of buffer indices handed from one stage to the next
+class BufferQueue {
+public:
+	void push(int index) {
+		{
+			lock_guard<mutex> lock(m);
+			items.push_back(index);
+		}
+		ready.notify_one();
+	}
+	int pop() {
+		unique_lock<mutex> lock(m);
+		while (items.empty()) { ready.wait(lock); }
+		int index = items.front();
+		items.pop_front();
+		return index;
+	}
+private:
+	mutex m;
+	condition_variable ready;
+	deque<int> items;
+};
+
+bool parse_key(const char* hex, unsigned char key[KEY_LEN]);
+void read_stage(ifstream& input, FileBuffer buffers[], BufferQueue& freeQ, BufferQueue& readQ);
+bool write_stage(ofstream& output, FileBuffer buffers[], BufferQueue& writeQ, BufferQueue& freeQ);
+
+int main(int argc, char* argv[]) {
+	if (argc != 7 || (strcmp(argv[1], "enc") != 0 && strcmp(argv[1], "dec") != 0)) {
+		cout << "Usage: " << argv[0] << " enc|dec <key: 32 hex digits> <seed> <rounds> <in> <out>" << endl;
+		return 1;
+	}
+
+	unsigned char key[KEY_LEN];
+	if (!parse_key(argv[2], key)) {
+		cout << "ERROR: The key must be " << 2 * KEY_LEN << " hex digits." << endl;
+		return 1;
+	}
+	bool encrypt = strcmp(argv[1], "enc") == 0;
+
+	ifstream input(argv[5], ios::binary);
+	ofstream output(argv[6], ios::binary);
+	if (!input || !output) {
+		cout << "ERROR: Can't open the input or output file." << endl;
+		return 1;
+	}
+
+	SPN spn(key, (unsigned int) strtoul(argv[3], NULL, 10), atoi(argv[4]));
+	spn.compile_key();
+	spn.set_num_threads(0);
+	SPN_Stream stream(spn, encrypt);
+
+	FileBuffer buffers[NUM_BUFFERS];
+	BufferQueue freeQ, readQ, writeQ;
+	for (int i = 0; i < NUM_BUFFERS; i++) {
+		buffers[i].in = new unsigned char[FILE_CHUNK];
+		buffers[i].out = new unsigned char[FILE_CHUNK + 2 * BLOCK_LEN];
+		freeQ.push(i);
+	}
+
+	bool writeOk = true;
+	thread reader(read_stage, ref(input), buffers, ref(freeQ), ref(readQ));
+	thread writer([&]() { writeOk = write_stage(output, buffers, writeQ, freeQ); });
+
+	// Cipher stage
+	bool padOk = true;
+	while (true) {
+		int i = readQ.pop();
+		FileBuffer& b = buffers[i];
+		b.outLen = stream.update(b.in, b.inLen, b.out);
+		if (b.last) {
+			int tail = stream.finalize(b.out + b.outLen);
+			if (tail < 0) { padOk = false; }
+			else { b.outLen += tail; }
+		}
+		writeQ.push(i);
+		if (b.last) { break; }
+	}
+
+	reader.join();
+	writer.join();
+	for (int i = 0; i < NUM_BUFFERS; i++) {
+		delete [] buffers[i].in;
+		delete [] buffers[i].out;
+	}
+
+	if (!padOk) {
+		cout << "ERROR: Ciphertext is truncated or was not made with this key." << endl;
+		return 1;
+	}
+	if (!writeOk) {
+		cout << "ERROR: Can't write the output file." << endl;
+		return 1;
+	}
+	return 0;
+}
+
+// Key given as 2 * KEY_LEN hex digits
+bool parse_key(const char* hex, unsigned char key[KEY_LEN]) {
+	if (strlen(hex) != 2 * KEY_LEN) { return false; }
+	for (int i = 0; i < KEY_LEN; i++) {
+		char byte[3] = {hex[2 * i], hex[2 * i + 1], '\0'};
+		char* end;
+		key[i] = (unsigned char) strtoul(byte, &end, 16);
+		if (*end != '\0') { return false; }
+	}
+	return true;
+}
+
+// Fill free buffers from the input file until it runs out
+void read_stage(ifstream& input, FileBuffer buffers[], BufferQueue& freeQ, BufferQueue& readQ) {
+	while (true) {
+		int i = freeQ.pop();
+		FileBuffer& b = buffers[i];
+		input.read((char*) b.in, FILE_CHUNK);
+		b.inLen = (size_t) input.gcount();
+		b.last = !input;
+		readQ.push(i);
+		if (b.last) { return; }
+	}
+}
+
+// Write ciphered buffers out and recycle them
+bool write_stage(ofstream& output, FileBuffer buffers[], BufferQueue& writeQ, BufferQueue& freeQ) {
+	bool ok = true;
+	while (true) {
+		int i = writeQ.pop();
+		FileBuffer& b = buffers[i];
+		output.write((const char*) b.out, b.outLen);
+		ok = ok && (bool) output;
+		bool last = b.last;
+		freeQ.push(i);
+		if (last) { return ok; }
+	}
+}
@@ -0,0 +1,217 @@
+/* SPN-1-0-image.cpp
+ *
+ * Implementation of image encryption on top of the SPN block API.
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#include "SPN-1-0-image.h"
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define IMAGE_TILE_BYTES SPN_CHUNK_BYTES // rows per tile add up to about this much
+
+using namespace std;
+using namespace cv;
+
+static void crypt_image(SPN& spn, const Mat& in, Mat& out, bool encrypt);
+static void put_le(unsigned char* p, uint64_t v, int n);
+static uint64_t get_le(const unsigned char* p, int n);
+
+
+void SPN_encrypt_image(SPN& spn, Mat& img) {
+	crypt_image(spn, img, img, true);
+}
+
+void SPN_decrypt_image(SPN& spn, Mat& img) {
+	crypt_image(spn, img, img, false);
+}
+
+void SPN_encrypt_image(SPN& spn, const Mat& in, Mat& out) {
+	out.create(in.rows, in.cols, in.type());
+	crypt_image(spn, in, out, true);
+}
+
+void SPN_decrypt_image(SPN& spn, const Mat& in, Mat& out) {
+	out.create(in.rows, in.cols, in.type());
+	crypt_image(spn, in, out, false);
+}
+
+static void crypt_image(SPN& spn, const Mat& in, Mat& out, bool encrypt) {
+	if (in.empty()) { return; }
+
+	// One stream: encrypt_blocks() already cuts it into tiles for the pool
+	if (in.isContinuous() && out.isContinuous()) {
+		size_t len = in.total() * in.elemSize();
+		if (encrypt) { SPN_encrypt_stream(spn, in.data, out.data, len); }
+		else { SPN_decrypt_stream(spn, in.data, out.data, len); }
+		return;
+	}
+
+	// One stream per row, tiles of whole rows
+	size_t rowLen = (size_t) in.cols * in.elemSize();
+	size_t rowsPerTile = IMAGE_TILE_BYTES / rowLen + 1;
+	spn.parallel_for((size_t) in.rows, rowsPerTile, [&](size_t begin, size_t end) {
+		for (size_t r = begin; r < end; r++) {
+			const unsigned char* src = in.ptr<unsigned char>((int) r);
+			unsigned char* dst = out.ptr<unsigned char>((int) r);
+			if (encrypt) { SPN_encrypt_stream(spn, src, dst, rowLen); }
+			else { SPN_decrypt_stream(spn, src, dst, rowLen); }
+		}
+	});
+}
+
+/*
+ * Full blocks are plain ECB. With r = len % BLOCK_LEN trailing bytes, the
+ * window of the last BLOCK_LEN bytes (the end of the last full ciphertext
+ * block plus the r plaintext bytes) is encrypted once more in place.
+ * Streams shorter than one block are XORed with E(0...0), which is all that
+ * fits without growing them.
+ */
+void SPN_encrypt_stream(SPN& spn, const unsigned char src[], unsigned char dst[], size_t len) {
+	size_t numBlocks = len / BLOCK_LEN;
+	size_t rest = len % BLOCK_LEN;
+
+	if (numBlocks == 0) {
+		unsigned char pad[BLOCK_LEN] = {0};
+		spn.encrypt_blocks(pad, pad, 1);
+		for (size_t i = 0; i < rest; i++) { dst[i] = src[i] ^ pad[i]; }
+		return;
+	}
+
+	spn.encrypt_blocks(src, dst, numBlocks);
+	if (rest != 0) {
+		unsigned char window[BLOCK_LEN];
+		memcpy(window, dst + len - BLOCK_LEN, BLOCK_LEN - rest);
+		memcpy(window + BLOCK_LEN - rest, src + numBlocks * BLOCK_LEN, rest);
+		spn.encrypt_blocks(window, dst + len - BLOCK_LEN, 1);
+	}
+}
+
+void SPN_decrypt_stream(SPN& spn, const unsigned char src[], unsigned char dst[], size_t len) {
+	size_t numBlocks = len / BLOCK_LEN;
+	size_t rest = len % BLOCK_LEN;
+
+	if (numBlocks == 0) {
+		SPN_encrypt_stream(spn, src, dst, len); // XOR is its own inverse
+		return;
+	}
+	if (rest == 0) {
+		spn.decrypt_blocks(src, dst, numBlocks);
+		return;
+	}
+
+	// Undo the window first: it holds the end of the last full ciphertext
+	// block followed by the plaintext tail
+	unsigned char window[BLOCK_LEN], last[BLOCK_LEN];
+	spn.decrypt_blocks(src + len - BLOCK_LEN, window, 1);
+	memcpy(last, src + (numBlocks - 1) * BLOCK_LEN, rest);
+	memcpy(last + rest, window, BLOCK_LEN - rest);
+
+	spn.decrypt_blocks(src, dst, numBlocks - 1);
+	spn.decrypt_blocks(last, dst + (numBlocks - 1) * BLOCK_LEN, 1);
+	memcpy(dst + numBlocks * BLOCK_LEN, window + BLOCK_LEN - rest, rest);
+}
+
+
+/******************************************************************************
+ *                        ENCRYPTED-IMAGE CONTAINER                           *
+ ******************************************************************************/
+
+bool SPN_save_image(SPN& spn, const Mat& img, const string& filename,
+					SPN_ImageMode mode, uint32_t nonce) {
+	if (img.empty()) { return false; }
+	Mat plain = img.isContinuous() ? img : img.clone();
+	size_t len = plain.total() * plain.elemSize();
+	size_t fileLen = SPN_IMAGE_HEADER_LEN + len;
+
+	int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) { return false; }
+	if (ftruncate(fd, (off_t) fileLen) != 0) {
+		close(fd);
+		return false;
+	}
+	unsigned char* file = (unsigned char*) mmap(NULL, fileLen, PROT_READ | PROT_WRITE,
+												MAP_SHARED, fd, 0);
+	close(fd);
+	if (file == MAP_FAILED) { return false; }
+
+	memset(file, 0, SPN_IMAGE_HEADER_LEN);
+	memcpy(file, "SPNI", 4);
+	file[4] = SPN_IMAGE_VERSION;
+	file[5] = (unsigned char) mode;
+	file[6] = (unsigned char) plain.channels();
+	file[7] = (unsigned char) plain.depth();
+	put_le(file + 8, (uint64_t) plain.rows, 4);
+	put_le(file + 12, (uint64_t) plain.cols, 4);
+	put_le(file + 16, (uint64_t) len, 8);
+	put_le(file + 24, (uint64_t) nonce, 4);
+
+	unsigned char* cipher = file + SPN_IMAGE_HEADER_LEN;
+	if (mode == SPN_IMAGE_CTR) { spn.encrypt_CTR_mode(plain.data, cipher, len, nonce); }
+	else { SPN_encrypt_stream(spn, plain.data, cipher, len); }
+
+	bool ok = msync(file, fileLen, MS_SYNC) == 0;
+	munmap(file, fileLen);
+	return ok;
+}
+
+bool SPN_load_image(SPN& spn, const string& filename, Mat& img) {
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) { return false; }
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t) st.st_size < SPN_IMAGE_HEADER_LEN) {
+		close(fd);
+		return false;
+	}
+	size_t fileLen = (size_t) st.st_size;
+	const unsigned char* file = (const unsigned char*) mmap(NULL, fileLen, PROT_READ,
+															MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (file == MAP_FAILED) { return false; }
+	madvise((void*) file, fileLen, MADV_SEQUENTIAL);
+
+	int mode = file[5];
+	int channels = file[6];
+	int depth = file[7];
+	int rows = (int) get_le(file + 8, 4);
+	int cols = (int) get_le(file + 12, 4);
+	uint64_t len = get_le(file + 16, 8);
+	uint32_t nonce = (uint32_t) get_le(file + 24, 4);
+
+	bool ok = memcmp(file, "SPNI", 4) == 0 && file[4] == SPN_IMAGE_VERSION
+		&& (mode == SPN_IMAGE_ECB || mode == SPN_IMAGE_CTR)
+		&& channels >= 1 && channels <= CV_CN_MAX && depth <= CV_64F
+		&& rows > 0 && cols > 0 && len == fileLen - SPN_IMAGE_HEADER_LEN;
+
+	// The pixel bytes the header describes must be exactly the bytes mapped,
+	// before anything is allocated for them. rows * cols is below 2^62.
+	if (ok) {
+		uint64_t pixels = (uint64_t) rows * (uint64_t) cols;
+		uint64_t pixelSize = (uint64_t) channels * CV_ELEM_SIZE1(CV_MAKETYPE(depth, 1));
+		ok = pixels <= UINT64_MAX / pixelSize && pixels * pixelSize == len;
+	}
+	if (ok) {
+		img.create(rows, cols, CV_MAKETYPE(depth, channels));
+		const unsigned char* cipher = file + SPN_IMAGE_HEADER_LEN;
+		if (mode == SPN_IMAGE_CTR) { spn.decrypt_CTR_mode(cipher, img.data, len, nonce); }
+		else { SPN_decrypt_stream(spn, cipher, img.data, len); }
+	}
+
+	munmap((void*) file, fileLen);
+	return ok;
+}
+
+// Little-endian n-byte integers of the container header
+static void put_le(unsigned char* p, uint64_t v, int n) {
+	for (int i = 0; i < n; i++) { p[i] = (unsigned char) (v >> (8 * i)); }
+}
+
+static uint64_t get_le(const unsigned char* p, int n) {
+	uint64_t v = 0;
+	for (int i = 0; i < n; i++) { v |= (uint64_t) p[i] << (8 * i); }
+	return v;
+}
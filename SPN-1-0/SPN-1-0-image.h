@@ -0,0 +1,67 @@
+/* SPN-1-0-image.h
+ *
+ * Header file of image encryption on top of the SPN block API. The pixel data
+ * of a cv::Mat is encrypted where it lies, interleaved channels and all, with
+ * no per-pixel access and no extra copies of the image.
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#ifndef __SPN_IMAGE__
+#define __SPN_IMAGE__
+
+#include "SPN-1-0.h"
+#include "opencv2/core/core.hpp"
+
+#define SPN_IMAGE_VERSION 1 // layout version of .spni containers
+#define SPN_IMAGE_HEADER_LEN 32 // ciphertext starts here, block aligned
+
+using namespace std;
+using namespace cv;
+
+// How the pixels of a container are encrypted
+enum SPN_ImageMode {
+	SPN_IMAGE_ECB,	// SPN_encrypt_stream() over the whole image
+	SPN_IMAGE_CTR	// CTR mode under the nonce stored in the header
+};
+
+/*
+ * ECB over the raw bytes of the image. A continuous Mat is one byte stream;
+ * otherwise every row is its own stream. A stream whose length is not a
+ * multiple of BLOCK_LEN gets its last BLOCK_LEN bytes encrypted once more, in
+ * place, so the size never changes and no padding row is needed. Work is
+ * split into tiles that run in parallel when the SPN has a thread pool.
+ */
+
+// Encrypt/decrypt img in place
+void SPN_encrypt_image(SPN& spn, Mat& img);
+void SPN_decrypt_image(SPN& spn, Mat& img);
+
+// Encrypt/decrypt in into out; out is (re)allocated only if its size or type differ
+void SPN_encrypt_image(SPN& spn, const Mat& in, Mat& out);
+void SPN_decrypt_image(SPN& spn, const Mat& in, Mat& out);
+
+// The same transform on one contiguous byte stream of len bytes (src may equal dst)
+void SPN_encrypt_stream(SPN& spn, const unsigned char src[], unsigned char dst[], size_t len);
+void SPN_decrypt_stream(SPN& spn, const unsigned char src[], unsigned char dst[], size_t len);
+
+/*
+ * Lossless encrypted-image container. All fields little-endian:
+ *
+ *   0  "SPNI"             4  version       5  mode        6  channels
+ *   7  depth (CV_8U...)   8  rows (u32)   12  cols (u32)
+ *  16  length (u64)      24  nonce (u32)  28  reserved, 0
+ *  32  length bytes of raw ciphertext, no padding
+ *
+ * Both ends map the file, so the pixels are encrypted straight into the page
+ * cache on save and decrypted straight out of it into the Mat on load.
+ */
+
+// Write img to filename; returns false on I/O errors
+bool SPN_save_image(SPN& spn, const Mat& img, const string& filename,
+	SPN_ImageMode mode = SPN_IMAGE_CTR, uint32_t nonce = 0);
+
+// Read filename into img; returns false on I/O errors or a malformed container
+bool SPN_load_image(SPN& spn, const string& filename, Mat& img);
+
+#endif
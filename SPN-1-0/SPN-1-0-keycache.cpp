@@ -0,0 +1,135 @@
+/* SPN-1-0-keycache.cpp
+ *
+ * Implementation of the cache of expanded key contexts.
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#include "SPN-1-0-keycache.h"
+
+using namespace std;
+
+// Never more shards than contexts, and the remainder of capacity / numShards
+// goes one each to the first shards, so the shards add up to capacity
+SPN_KeyCache::SPN_KeyCache(size_t capacity, int numShards) {
+	if (capacity == 0) { capacity = 1; }
+	this->numShards = numShards > 0 ? numShards : 1;
+	if ((size_t) this->numShards > capacity) { this->numShards = (int) capacity; }
+	shards = new Shard[this->numShards];
+	for (int i = 0; i < this->numShards; i++) {
+		shards[i].capacity = capacity / this->numShards
+			+ ((size_t) i < capacity % this->numShards ? 1 : 0);
+		shards[i].numHits = 0;
+		shards[i].numMisses = 0;
+		shards[i].numEvictions = 0;
+	}
+}
+
+SPN_KeyCache::~SPN_KeyCache() {
+	delete [] shards;
+}
+
+// Cache key of the explicit-key constructor: tag, key, seed, rounds
+shared_ptr<SPN> SPN_KeyCache::get(const unsigned char k[KEY_LEN], unsigned int seed, int nr) {
+	string name(1, 'K');
+	name.append((const char*) k, KEY_LEN);
+	for (int i = 0; i < 4; i++) { name += (char) (seed >> (8 * i)); }
+	for (int i = 0; i < 4; i++) { name += (char) ((unsigned int) nr >> (8 * i)); }
+
+	return lookup(name, [&]() { return new SPN(k, seed, nr); });
+}
+
+// Cache key of an id: its own tag, so ids never collide with key bytes
+shared_ptr<SPN> SPN_KeyCache::get(uint64_t id, const function<SPN*(uint64_t)>& load) {
+	string name(1, 'I');
+	for (int i = 0; i < 8; i++) { name += (char) (id >> (8 * i)); }
+
+	return lookup(name, [&]() { return load(id); });
+}
+
+/*
+ * Hits only splice the entry to the front of its shard's list. A miss
+ * releases the lock while the context is built, since building takes far
+ * longer than a lookup; if another thread inserted the same key meanwhile,
+ * its context wins and ours is dropped.
+ */
+shared_ptr<SPN> SPN_KeyCache::lookup(const string& name, const function<SPN*()>& make) {
+	Shard& shard = shards[hash<string>()(name) % numShards];
+	{
+		lock_guard<mutex> guard(shard.lock);
+		unordered_map<string, Entry>::iterator it = shard.entries.find(name);
+		if (it != shard.entries.end()) {
+			shard.numHits++;
+			shard.lru.splice(shard.lru.begin(), shard.lru, it->second.pos);
+			return it->second.spn;
+		}
+		shard.numMisses++;
+	}
+
+	SPN* built = make();
+	if (built == NULL) { return shared_ptr<SPN>(); }
+	built->compile_key();
+	shared_ptr<SPN> spn(built);
+
+	lock_guard<mutex> guard(shard.lock);
+	unordered_map<string, Entry>::iterator it = shard.entries.find(name);
+	if (it != shard.entries.end()) {
+		shard.lru.splice(shard.lru.begin(), shard.lru, it->second.pos);
+		return it->second.spn;
+	}
+	while (shard.entries.size() >= shard.capacity) {
+		shard.entries.erase(shard.lru.back());
+		shard.lru.pop_back();
+		shard.numEvictions++;
+	}
+	shard.lru.push_front(name);
+	Entry entry;
+	entry.spn = spn;
+	entry.pos = shard.lru.begin();
+	shard.entries[name] = entry;
+	return spn;
+}
+
+void SPN_KeyCache::clear() {
+	for (int i = 0; i < numShards; i++) {
+		lock_guard<mutex> guard(shards[i].lock);
+		shards[i].entries.clear();
+		shards[i].lru.clear();
+	}
+}
+
+size_t SPN_KeyCache::size() const {
+	size_t n = 0;
+	for (int i = 0; i < numShards; i++) {
+		lock_guard<mutex> guard(shards[i].lock);
+		n += shards[i].entries.size();
+	}
+	return n;
+}
+
+uint64_t SPN_KeyCache::hits() const {
+	uint64_t n = 0;
+	for (int i = 0; i < numShards; i++) {
+		lock_guard<mutex> guard(shards[i].lock);
+		n += shards[i].numHits;
+	}
+	return n;
+}
+
+uint64_t SPN_KeyCache::misses() const {
+	uint64_t n = 0;
+	for (int i = 0; i < numShards; i++) {
+		lock_guard<mutex> guard(shards[i].lock);
+		n += shards[i].numMisses;
+	}
+	return n;
+}
+
+uint64_t SPN_KeyCache::evictions() const {
+	uint64_t n = 0;
+	for (int i = 0; i < numShards; i++) {
+		lock_guard<mutex> guard(shards[i].lock);
+		n += shards[i].numEvictions;
+	}
+	return n;
+}
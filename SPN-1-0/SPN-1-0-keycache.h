@@ -0,0 +1,92 @@
+/* SPN-1-0-keycache.h
+ *
+ * Header file of a bounded cache of expanded key contexts. Services that
+ * rotate among thousands of keys would otherwise rebuild an SPN (key
+ * schedule, permutation, kernel tables, compile_key()) for every request.
+ * SPN_KeyCache keeps the most recently used contexts, up to a fixed count,
+ * and evicts the least recently used one of a shard when the shard is full.
+ *
+ * The cache is split into shards, each an LRU list with its own mutex, and
+ * a key always lands in the same shard; concurrent lookups of different
+ * keys rarely wait for each other. A miss builds the context outside the
+ * lock. Contexts are handed out as shared_ptr, so an evicted context stays
+ * alive until its last user lets go. Contexts are shared between threads:
+ * encrypt/decrypt freely, but don't reconfigure them (set_kernel(),
+ * set_sbox(), set_num_threads(), set_tracer()).
+ *
+ * Cached contexts are compiled (compile_key()), which leaves them without
+ * T-tables: about 2 KB each. A context loaded with a custom S-box keeps its
+ * tables and takes about 34 KB.
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#ifndef __SPN_KEYCACHE__
+#define __SPN_KEYCACHE__
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include "SPN-1-0.h"
+
+#define KEYCACHE_SHARDS 16 // default number of independently locked shards
+
+using namespace std;
+
+class SPN_KeyCache {
+
+public:
+
+	// Room for exactly capacity contexts (at least 1), spread over numShards
+	// shards, or over capacity shards if that is fewer
+	SPN_KeyCache(size_t capacity, int numShards = KEYCACHE_SHARDS);
+
+	~SPN_KeyCache();
+
+	// Context of SPN(k, seed, nr), built (silently) and compiled on a miss
+	shared_ptr<SPN> get(const unsigned char k[KEY_LEN], unsigned int seed, int nr = 4);
+
+	// Context known by id; on a miss load(id) builds it (for example with
+	// SPN::import_schedule()) and the cache takes ownership. If load returns
+	// NULL, nothing is cached and the result is empty.
+	shared_ptr<SPN> get(uint64_t id, const function<SPN*(uint64_t)>& load);
+
+	// Drop every context (users keep theirs until they let go)
+	void clear();
+
+	// Contexts held, and lookups since construction
+	size_t size() const;
+	uint64_t hits() const;
+	uint64_t misses() const;
+	uint64_t evictions() const;
+
+private:
+
+	struct Entry {
+		shared_ptr<SPN> spn;
+		list<string>::iterator pos; // position in the shard's LRU list
+	};
+
+	struct Shard {
+		mutable mutex lock;
+		list<string> lru; // cache keys, most recent first
+		unordered_map<string, Entry> entries;
+		size_t capacity; // contexts this shard holds at most
+		uint64_t numHits, numMisses, numEvictions;
+	};
+
+	Shard* shards;
+	int numShards;
+
+	// Look name up, or build it with make() and insert it
+	shared_ptr<SPN> lookup(const string& name, const function<SPN*()>& make);
+
+	// No copies: the shards hold mutexes
+	SPN_KeyCache(const SPN_KeyCache&);
+	SPN_KeyCache& operator=(const SPN_KeyCache&);
+};
+
+#endif
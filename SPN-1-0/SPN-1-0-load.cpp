@@ -0,0 +1,140 @@
+/* SPN-1-0-load.cpp
+ *
+ * Load generator for the encryption daemon. Every client thread holds its
+ * own connection and sends requests back to back; the latency of each one is
+ * recorded, and the run prints throughput with the p50/p99/p99.9 latencies
+ * as one JSON object per line (as SPN-bench does).
+ *
+ * Usage: ./SPN-load <socket> [--clients N,N,...] [--requests N] [--size BYTES]
+ *                   [--key ID]
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include "SPN-1-0.h"
+#include "SPN-1-0-daemon.h"
+
+using namespace std;
+
+// What one client thread measured
+struct ClientResult {
+	vector<double> latencies; // microseconds
+	bool ok;
+};
+
+void run_client(const string& socketPath, int key, size_t size, int requests,
+				unsigned int seed, ClientResult& result);
+double percentile(const vector<double>& sorted, double p);
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		cout << "Usage: " << argv[0] << " <socket> [--clients N,N,...] [--requests N]"
+			 << " [--size BYTES] [--key ID]" << endl;
+		return 1;
+	}
+	string socketPath(argv[1]);
+	vector<int> clientCounts;
+	int requests = 10000;
+	size_t size = 64;
+	int key = 0;
+
+	for (int i = 2; i + 1 < argc; i += 2) {
+		string opt(argv[i]);
+		if (opt == "--requests") { requests = atoi(argv[i + 1]); }
+		else if (opt == "--size") { size = strtoull(argv[i + 1], NULL, 10); }
+		else if (opt == "--key") { key = atoi(argv[i + 1]); }
+		else if (opt == "--clients") {
+			stringstream list(argv[i + 1]);
+			string item;
+			while (getline(list, item, ',')) { clientCounts.push_back(atoi(item.c_str())); }
+		}
+		else {
+			cout << "Unknown option " << opt << endl;
+			return 1;
+		}
+	}
+	if (clientCounts.empty()) {
+		clientCounts.push_back(1);
+		clientCounts.push_back(8);
+		clientCounts.push_back(64);
+	}
+	size = max((size_t) BLOCK_LEN, size / BLOCK_LEN * BLOCK_LEN);
+
+	for (size_t c = 0; c < clientCounts.size(); c++) {
+		int numClients = clientCounts[c];
+		vector<ClientResult> results(numClients);
+		vector<thread> threads;
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (int t = 0; t < numClients; t++) {
+			threads.push_back(thread(run_client, socketPath, key, size, requests,
+									 (unsigned int) t + 1, ref(results[t])));
+		}
+		for (int t = 0; t < numClients; t++) { threads[t].join(); }
+		double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		vector<double> all;
+		for (int t = 0; t < numClients; t++) {
+			if (!results[t].ok) {
+				cerr << "ERROR: Client " << t << " failed; is the daemon serving key "
+					 << key << " on " << socketPath << "?" << endl;
+				return 1;
+			}
+			all.insert(all.end(), results[t].latencies.begin(), results[t].latencies.end());
+		}
+		sort(all.begin(), all.end());
+
+		cout << "{\"clients\":" << numClients << ",\"bytes\":" << size
+			 << ",\"requests\":" << all.size()
+			 << ",\"req_per_s\":" << all.size() / elapsed
+			 << ",\"mb_per_s\":" << all.size() * size / elapsed / 1e6
+			 << ",\"p50_us\":" << percentile(all, 0.50)
+			 << ",\"p99_us\":" << percentile(all, 0.99)
+			 << ",\"p999_us\":" << percentile(all, 0.999) << "}" << endl;
+	}
+	return 0;
+}
+
+// One connection: check a round trip, then time requests back to back
+void run_client(const string& socketPath, int key, size_t size, int requests,
+				unsigned int seed, ClientResult& result) {
+	result.ok = false;
+	SPN_Client client;
+	if (!client.connect(socketPath)) { return; }
+
+	size_t nblocks = size / BLOCK_LEN;
+	vector<unsigned char> in(size), out(size), back(size);
+	for (size_t i = 0; i < size; i++) { in[i] = (unsigned char) (rand_r(&seed) % 256); }
+
+	if (!client.encrypt_blocks(key, &in[0], &out[0], nblocks)
+		|| !client.decrypt_blocks(key, &out[0], &back[0], nblocks)
+		|| back != in) {
+		return;
+	}
+
+	result.latencies.reserve(requests);
+	for (int r = 0; r < requests; r++) {
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		if (!client.encrypt_blocks(key, &in[0], &out[0], nblocks)) { return; }
+		result.latencies.push_back(chrono::duration<double, micro>(
+			chrono::steady_clock::now() - start).count());
+		in[r % size] ^= out[0]; // vary the payload a little
+	}
+	result.ok = true;
+}
+
+// p-th quantile of sorted latencies (nearest rank)
+double percentile(const vector<double>& sorted, double p) {
+	if (sorted.empty()) { return 0; }
+	size_t rank = (size_t) (p * sorted.size());
+	return sorted[min(rank, sorted.size() - 1)];
+}
@@ -0,0 +1,115 @@
+/* SPN-1-0-pool.cpp
+ *
+ * Implementation of a persistent worker pool used to spread independent
+ * blocks over several cores.
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#include "SPN-1-0-pool.h"
+
+using namespace std;
+
+// True while this thread runs chunks of some pool's job. A body that calls
+// parallel_for() again (a tile loop whose tiles encrypt blocks, say) must
+// not touch callMutex, which its own thread may hold.
+static thread_local bool insidePool = false;
+
+// Start numThreads - 1 workers; the calling thread is the last worker
+SPN_ThreadPool::SPN_ThreadPool(int numThreads) {
+	job = NULL;
+	jobCount = 0;
+	jobChunk = 1;
+	next = 0;
+	active = 0;
+	generation = 0;
+	stop = false;
+
+	for (int i = 1; i < numThreads; i++) {
+		workers.push_back(thread(&SPN_ThreadPool::worker_loop, this));
+	}
+}
+
+// Destructor: stop and join all workers
+SPN_ThreadPool::~SPN_ThreadPool() {
+	{
+		lock_guard<mutex> lock(jobMutex);
+		stop = true;
+	}
+	jobReady.notify_all();
+	for (size_t i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+}
+
+int SPN_ThreadPool::size() const {
+	return (int) workers.size() + 1;
+}
+
+void SPN_ThreadPool::parallel_for(size_t count, size_t chunkSize,
+								  const function<void(size_t, size_t)>& body) {
+	if (chunkSize == 0) { chunkSize = 1; }
+
+	// Nothing to share, a nested call, or the pool is busy serving someone else
+	if (workers.empty() || count <= chunkSize || insidePool || !callMutex.try_lock()) {
+		body(0, count);
+		return;
+	}
+
+	{
+		lock_guard<mutex> lock(jobMutex);
+		job = &body;
+		jobCount = count;
+		jobChunk = chunkSize;
+		next = 0;
+		active = (int) workers.size();
+		generation++;
+	}
+	jobReady.notify_all();
+
+	// The caller works too
+	run_chunks();
+
+	{
+		unique_lock<mutex> lock(jobMutex);
+		while (active > 0) {
+			jobDone.wait(lock);
+		}
+		job = NULL;
+	}
+	callMutex.unlock();
+}
+
+void SPN_ThreadPool::run_chunks() {
+	insidePool = true;
+	while (true) {
+		size_t begin = next.fetch_add(jobChunk);
+		if (begin >= jobCount) { break; }
+		size_t end = begin + jobChunk;
+		if (end > jobCount) { end = jobCount; }
+		(*job)(begin, end);
+	}
+	insidePool = false;
+}
+
+void SPN_ThreadPool::worker_loop() {
+	unsigned long seen = 0;
+	while (true) {
+		{
+			unique_lock<mutex> lock(jobMutex);
+			while (!stop && generation == seen) {
+				jobReady.wait(lock);
+			}
+			if (stop) { return; }
+			seen = generation;
+		}
+
+		run_chunks();
+
+		{
+			lock_guard<mutex> lock(jobMutex);
+			active--;
+			if (active == 0) { jobDone.notify_one(); }
+		}
+	}
+}
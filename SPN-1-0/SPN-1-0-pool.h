@@ -0,0 +1,63 @@
+/* SPN-1-0-pool.h
+ *
+ * Header file of a persistent worker pool used to spread independent blocks
+ * over several cores.
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#ifndef __SPN_POOL__
+#define __SPN_POOL__
+
+#include <cstddef>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+using namespace std;
+
+class SPN_ThreadPool {
+
+public:
+
+	// Start numThreads - 1 workers; the calling thread is the last worker
+	SPN_ThreadPool(int numThreads);
+
+	// Destructor: stop and join all workers
+	~SPN_ThreadPool();
+
+	// Number of threads taking part in parallel_for(), caller included
+	int size() const;
+
+	// Run body(begin, end) over [0, count) in chunks of chunkSize. Workers
+	// claim the next free chunk as soon as they finish one, so faster threads
+	// simply take more chunks. Returns once every chunk is done. If another
+	// thread is already using the pool, or body itself calls parallel_for()
+	// (of any pool), the call runs serially on the caller.
+	void parallel_for(size_t count, size_t chunkSize,
+					  const function<void(size_t, size_t)>& body);
+
+private:
+
+	vector<thread> workers;
+	mutex jobMutex; // guards everything below except next
+	condition_variable jobReady, jobDone;
+	mutex callMutex; // one parallel_for() at a time
+	const function<void(size_t, size_t)>* job;
+	size_t jobCount, jobChunk;
+	atomic<size_t> next; // first index of the next unclaimed chunk
+	int active; // workers still running the current job
+	unsigned long generation; // bumped for every new job
+	bool stop;
+
+	// Worker main loop
+	void worker_loop();
+
+	// Claim and run chunks until the job is exhausted
+	void run_chunks();
+};
+
+#endif
@@ -0,0 +1,169 @@
+/* SPN-1-0-reader.cpp
+ *
+ * Implementation of the random-access reader for encrypted files.
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#include "SPN-1-0-reader.h"
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+SPN_Reader::SPN_Reader(SPN& cipher, size_t pageBlocks, size_t cachePages) : spn(cipher) {
+	ctr = false;
+	ctrNonce = 0;
+	ctrCounter = 0;
+	file = NULL;
+	fileLen = 0;
+	data = NULL;
+	dataLen = 0;
+	pageBytes = (pageBlocks > 0 ? pageBlocks : 1) * BLOCK_LEN;
+	maxPages = cachePages > 0 ? cachePages : 1;
+	slots.resize(maxPages * pageBytes);
+	numHits = 0;
+	numMisses = 0;
+}
+
+SPN_Reader::~SPN_Reader() {
+	close();
+}
+
+bool SPN_Reader::open(const string& filename, uint64_t offset) {
+	close();
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) { return false; }
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (uint64_t) st.st_size < offset) {
+		::close(fd);
+		return false;
+	}
+
+	size_t len = (size_t) st.st_size;
+	if (len > 0) {
+		void* map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED) {
+			::close(fd);
+			return false;
+		}
+		// Reads jump around; don't let the kernel read ahead of them
+		madvise(map, len, MADV_RANDOM);
+		file = (const unsigned char*) map;
+	}
+	::close(fd);
+
+	fileLen = len;
+	data = file + offset;
+	dataLen = len - offset;
+	numHits = 0;
+	numMisses = 0;
+	return true;
+}
+
+void SPN_Reader::close() {
+	if (file != NULL) { munmap((void*) file, fileLen); }
+	file = NULL;
+	fileLen = 0;
+	data = NULL;
+	dataLen = 0;
+	clear_cache();
+}
+
+void SPN_Reader::set_ECB_mode() {
+	ctr = false;
+	clear_cache();
+}
+
+void SPN_Reader::set_CTR_mode(uint32_t nonce, uint32_t counter) {
+	ctr = true;
+	ctrNonce = nonce;
+	ctrCounter = counter;
+	clear_cache();
+}
+
+uint64_t SPN_Reader::size() const {
+	return ctr ? dataLen : dataLen / BLOCK_LEN * BLOCK_LEN;
+}
+
+size_t SPN_Reader::read(uint64_t pos, unsigned char out[], size_t len) {
+	uint64_t end = size();
+	if (pos >= end) { return 0; }
+	if (len > end - pos) { len = (size_t) (end - pos); }
+
+	size_t done = 0;
+	while (done < len) {
+		uint64_t at = pos + done;
+		size_t inPage = (size_t) (at % pageBytes);
+		size_t n = min(len - done, pageBytes - inPage);
+		memcpy(out + done, page(at / pageBytes) + inPage, n);
+		done += n;
+	}
+	return len;
+}
+
+const unsigned char* SPN_Reader::block(uint64_t index) {
+	if (index >= size() / BLOCK_LEN) { return NULL; }
+	uint64_t at = index * BLOCK_LEN;
+	return page(at / pageBytes) + at % pageBytes;
+}
+
+uint64_t SPN_Reader::hits() const {
+	return numHits;
+}
+
+uint64_t SPN_Reader::misses() const {
+	return numMisses;
+}
+
+/*
+ * The cache is a fixed set of page slots. The LRU list holds page numbers,
+ * most recent first, and the map finds a page's slot and list position, so
+ * a hit and an eviction are both O(1).
+ */
+const unsigned char* SPN_Reader::page(uint64_t index) {
+	unordered_map<uint64_t, CachedPage>::iterator it = cache.find(index);
+	if (it != cache.end()) {
+		numHits++;
+		lru.splice(lru.begin(), lru, it->second.pos);
+		return &slots[it->second.slot * pageBytes];
+	}
+	numMisses++;
+
+	size_t slot;
+	if (cache.size() < maxPages) {
+		slot = cache.size();
+	}
+	else {
+		uint64_t victim = lru.back();
+		slot = cache[victim].slot;
+		cache.erase(victim);
+		lru.pop_back();
+	}
+
+	// Only the pages actually touched are ever decrypted
+	uint64_t offset = index * pageBytes;
+	size_t len = (size_t) min((uint64_t) pageBytes, size() - offset);
+	unsigned char* out = &slots[slot * pageBytes];
+	if (ctr) {
+		spn.decrypt_CTR_mode(data + offset, out, len, ctrNonce, ctrCounter, offset);
+	}
+	else {
+		spn.decrypt_blocks(data + offset, out, len / BLOCK_LEN);
+	}
+
+	lru.push_front(index);
+	CachedPage entry;
+	entry.slot = slot;
+	entry.pos = lru.begin();
+	cache[index] = entry;
+	return out;
+}
+
+void SPN_Reader::clear_cache() {
+	cache.clear();
+	lru.clear();
+}
@@ -0,0 +1,97 @@
+/* SPN-1-0-reader.h
+ *
+ * Header file of a random-access reader for encrypted files. The ciphertext
+ * is memory-mapped and decrypted lazily, one page of blocks at a time, into
+ * a small LRU cache, so touching a few spots of a huge file costs only the
+ * pages around them. Works for ECB and for CTR (which needs no earlier
+ * blocks to decrypt a page). One reader is not safe to share between threads.
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#ifndef __SPN_READER__
+#define __SPN_READER__
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include "SPN-1-0.h"
+
+#define READER_PAGE_BLOCKS 512 // blocks decrypted per cache page (4 KiB)
+#define READER_CACHE_PAGES 64 // pages kept decrypted
+
+using namespace std;
+
+class SPN_Reader {
+
+public:
+
+	// Reader decrypting with cipher (which must outlive it), in ECB mode
+	SPN_Reader(SPN& cipher, size_t pageBlocks = READER_PAGE_BLOCKS,
+			   size_t cachePages = READER_CACHE_PAGES);
+
+	// Destructor: unmap the file
+	~SPN_Reader();
+
+	// Map filename; the ciphertext starts offset bytes into it (after a
+	// container header, say). Returns false if it can't be mapped.
+	bool open(const string& filename, uint64_t offset = 0);
+
+	// Unmap the file, if any
+	void close();
+
+	// Mode of the ciphertext; both drop the cache
+	void set_ECB_mode();
+	void set_CTR_mode(uint32_t nonce, uint32_t counter = 0);
+
+	// Readable plaintext bytes: the whole ciphertext in CTR mode, whole
+	// blocks only in ECB mode
+	uint64_t size() const;
+
+	// Copy plaintext bytes [pos, pos + len) to out, clipped to size().
+	// Returns how many were copied.
+	size_t read(uint64_t pos, unsigned char out[], size_t len);
+
+	// Plaintext of block index, valid until the next call on the reader;
+	// NULL past the end
+	const unsigned char* block(uint64_t index);
+
+	// Cache statistics since open()
+	uint64_t hits() const;
+	uint64_t misses() const;
+
+private:
+
+	SPN& spn;
+	bool ctr;
+	uint32_t ctrNonce, ctrCounter;
+
+	const unsigned char* file;
+	size_t fileLen;
+	const unsigned char* data; // first byte of ciphertext
+	uint64_t dataLen;
+
+	size_t pageBytes;
+	size_t maxPages;
+	vector<unsigned char> slots; // maxPages pages of plaintext
+	list<uint64_t> lru; // cached pages, most recently used first
+	struct CachedPage {
+		size_t slot;
+		list<uint64_t>::iterator pos;
+	};
+	unordered_map<uint64_t, CachedPage> cache;
+	uint64_t numHits, numMisses;
+
+	// Plaintext of page, decrypting it if it is not cached
+	const unsigned char* page(uint64_t index);
+
+	// Drop every cached page
+	void clear_cache();
+
+	// No copies: the mapping belongs to one object
+	SPN_Reader(const SPN_Reader&);
+	SPN_Reader& operator=(const SPN_Reader&);
+};
+
+#endif
@@ -0,0 +1,200 @@
+/* SPN-1-0-static.h
+ *
+ * Compile-time specialized SPN: block length and number of rounds are
+ * template parameters, subkeys are stored inline in std::arrays and the
+ * rounds are unrolled by template recursion, so the compiler can keep a whole
+ * block in registers. The runtime SPN class dispatches to the common
+ * instantiations through SPN_BlockKernel.
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#ifndef __SPN_STATIC__
+#define __SPN_STATIC__
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+using namespace std;
+
+// A block cipher kernel that can run behind SPN::encrypt_blocks()
+class SPN_BlockKernel {
+
+public:
+
+	virtual ~SPN_BlockKernel() {}
+
+	virtual void encrypt_blocks(const unsigned char in[], unsigned char out[],
+								size_t nblocks) const = 0;
+	virtual void decrypt_blocks(const unsigned char in[], unsigned char out[],
+								size_t nblocks) const = 0;
+};
+
+/*
+ * Whole-block operations. The generic version works byte by byte; the 8- and
+ * 16-byte specializations work on 64-bit words.
+ */
+template <int BlockLen>
+struct SPN_BlockOps {
+	typedef array<unsigned char, BlockLen> Block;
+
+	// x = ~(x ^ k): XOR with subkey followed by pi_S()
+	static inline void xor_sub(Block& x, const Block& k) {
+		for (int i = 0; i < BlockLen; i++) { x[i] = (unsigned char) ~(x[i] ^ k[i]); }
+	}
+	// x = x ^ k
+	static inline void xor_key(Block& x, const Block& k) {
+		for (int i = 0; i < BlockLen; i++) { x[i] ^= k[i]; }
+	}
+};
+
+template <>
+struct SPN_BlockOps<8> {
+	typedef array<unsigned char, 8> Block;
+
+	static inline void xor_sub(Block& x, const Block& k) {
+		uint64_t a, b;
+		memcpy(&a, x.data(), 8);
+		memcpy(&b, k.data(), 8);
+		a = ~(a ^ b);
+		memcpy(x.data(), &a, 8);
+	}
+	static inline void xor_key(Block& x, const Block& k) {
+		uint64_t a, b;
+		memcpy(&a, x.data(), 8);
+		memcpy(&b, k.data(), 8);
+		a ^= b;
+		memcpy(x.data(), &a, 8);
+	}
+};
+
+template <>
+struct SPN_BlockOps<16> {
+	typedef array<unsigned char, 16> Block;
+
+	static inline void xor_sub(Block& x, const Block& k) {
+		uint64_t a[2], b[2];
+		memcpy(a, x.data(), 16);
+		memcpy(b, k.data(), 16);
+		a[0] = ~(a[0] ^ b[0]);
+		a[1] = ~(a[1] ^ b[1]);
+		memcpy(x.data(), a, 16);
+	}
+	static inline void xor_key(Block& x, const Block& k) {
+		uint64_t a[2], b[2];
+		memcpy(a, x.data(), 16);
+		memcpy(b, k.data(), 16);
+		a[0] ^= b[0];
+		a[1] ^= b[1];
+		memcpy(x.data(), a, 16);
+	}
+};
+
+template <int BlockLen, int Rounds>
+class SPN_Static : public SPN_BlockKernel {
+
+public:
+
+	typedef SPN_BlockOps<BlockLen> Ops;
+	typedef typename Ops::Block Block;
+
+	// subkeys: (Rounds + 1) subkeys of BlockLen bytes
+	// perm: pi_P() as a gather, permuted[i] = input[perm[i]]
+	SPN_Static(const unsigned char* const subkeyRows[], const unsigned char perm[]) {
+		for (int r = 0; r < Rounds + 1; r++) {
+			memcpy(subkeys[r].data(), subkeyRows[r], BlockLen);
+		}
+		for (int i = 0; i < BlockLen; i++) {
+			pIndex[i] = perm[i];
+			pIndexInverse[perm[i]] = (unsigned char) i;
+		}
+	}
+
+	void encrypt_block(const unsigned char in[], unsigned char out[]) const {
+		Block x;
+		memcpy(x.data(), in, BlockLen);
+		EncryptRounds<0>::run(*this, x);
+		// the last round does not permute, then output whitening
+		Ops::xor_sub(x, subkeys[Rounds - 1]);
+		Ops::xor_key(x, subkeys[Rounds]);
+		memcpy(out, x.data(), BlockLen);
+	}
+
+	void decrypt_block(const unsigned char in[], unsigned char out[]) const {
+		Block x;
+		memcpy(x.data(), in, BlockLen);
+		// de-whitening, unwind the last pi_S() and XOR
+		Ops::xor_key(x, subkeys[Rounds]);
+		Ops::xor_sub(x, subkeys[Rounds - 1]);
+		// ~x ^ k == ~(x ^ k), so xor_sub() also unwinds pi_S() and XOR
+		DecryptRounds<Rounds - 2>::run(*this, x);
+		memcpy(out, x.data(), BlockLen);
+	}
+
+	void encrypt_blocks(const unsigned char in[], unsigned char out[], size_t nblocks) const {
+		for (size_t s = 0; s < nblocks; s++) {
+			encrypt_block(in + s * BlockLen, out + s * BlockLen);
+		}
+	}
+
+	void decrypt_blocks(const unsigned char in[], unsigned char out[], size_t nblocks) const {
+		for (size_t s = 0; s < nblocks; s++) {
+			decrypt_block(in + s * BlockLen, out + s * BlockLen);
+		}
+	}
+
+private:
+
+	array<Block, Rounds + 1> subkeys;
+	array<unsigned char, BlockLen> pIndex, pIndexInverse;
+
+	static inline void permute(Block& x, const array<unsigned char, BlockLen>& perm) {
+		Block y;
+		for (int i = 0; i < BlockLen; i++) { y[i] = x[perm[i]]; }
+		x = y;
+	}
+
+	// Rounds R .. Rounds - 2 of encryption: XOR, pi_S(), pi_P()
+	template <int R, bool Done = (R >= Rounds - 1)>
+	struct EncryptRounds {
+		static inline void run(const SPN_Static& c, Block& x) {
+			Ops::xor_sub(x, c.subkeys[R]);
+			permute(x, c.pIndex);
+			EncryptRounds<R + 1>::run(c, x);
+		}
+	};
+	template <int R>
+	struct EncryptRounds<R, true> {
+		static inline void run(const SPN_Static&, Block&) {}
+	};
+
+	// Rounds R .. 0 of decryption: unwind pi_P(), pi_S(), XOR
+	template <int R, bool Done = (R < 0)>
+	struct DecryptRounds {
+		static inline void run(const SPN_Static& c, Block& x) {
+			permute(x, c.pIndexInverse);
+			Ops::xor_sub(x, c.subkeys[R]);
+			DecryptRounds<R - 1>::run(c, x);
+		}
+	};
+	template <int R>
+	struct DecryptRounds<R, true> {
+		static inline void run(const SPN_Static&, Block&) {}
+	};
+};
+
+// Instantiation for a runtime round count, or NULL if there is none
+template <int BlockLen>
+SPN_BlockKernel* make_static_kernel(int rounds, const unsigned char* const subkeyRows[],
+									const unsigned char perm[]) {
+	switch (rounds) {
+		case 4:  return new SPN_Static<BlockLen, 4>(subkeyRows, perm);
+		case 8:  return new SPN_Static<BlockLen, 8>(subkeyRows, perm);
+		case 16: return new SPN_Static<BlockLen, 16>(subkeyRows, perm);
+		default: return NULL;
+	}
+}
+
+#endif
@@ -0,0 +1,74 @@
+/* SPN-1-0-stats.h
+ *
+ * Opt-in instrumentation of the SPN engine: block/byte/allocation counts and
+ * time spent per stage. Build everything with -DSPN_STATS to turn it on;
+ * otherwise the counters do not exist and every SPN_STAT_* macro expands to
+ * nothing. All translation units must agree on SPN_STATS.
+ *
+ * Stage times are in rdtsc cycles on x86 and steady_clock nanoseconds
+ * elsewhere.
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#ifndef __SPN_STATS__
+#define __SPN_STATS__
+
+#include <stdint.h>
+
+// Snapshot of the instrumentation counters (all zero without SPN_STATS)
+struct SPN_Stats {
+	uint64_t blocks;        // blocks run through a cipher kernel
+	uint64_t bytes;         // bytes handed to the public encrypt/decrypt API, before padding
+	uint64_t allocations;   // buffers allocated for the caller (ECB/CBC results)
+	uint64_t prepareCycles; // prepare_string_ECB_mode()
+	uint64_t xorCycles;     // operation_XOR()
+	uint64_t subsCycles;    // pi_S()
+	uint64_t permCycles;    // pi_P()
+	uint64_t kernelCycles;  // whole block ranges, the stages above included
+};
+
+#ifdef SPN_STATS
+
+#include <atomic>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Live counters, updated from any thread
+struct SPN_Counters {
+	std::atomic<uint64_t> blocks, bytes, allocations;
+	std::atomic<uint64_t> prepareCycles, xorCycles, subsCycles, permCycles, kernelCycles;
+};
+
+static inline uint64_t spn_stat_clock() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Adds the time between construction and destruction to a counter
+class SPN_StageTimer {
+public:
+	SPN_StageTimer(std::atomic<uint64_t>& c) : counter(c), start(spn_stat_clock()) {}
+	~SPN_StageTimer() { counter.fetch_add(spn_stat_clock() - start, std::memory_order_relaxed); }
+private:
+	std::atomic<uint64_t>& counter;
+	uint64_t start;
+};
+
+#define SPN_STAT_ADD(field, n) stats.field.fetch_add((n), std::memory_order_relaxed)
+#define SPN_STAT_TIME(field) SPN_StageTimer field##Timer(stats.field)
+
+#else
+
+#define SPN_STAT_ADD(field, n) ((void) 0)
+#define SPN_STAT_TIME(field) ((void) 0)
+
+#endif
+
+#endif
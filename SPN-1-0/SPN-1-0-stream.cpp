@@ -0,0 +1,90 @@
+/* SPN-1-0-stream.cpp
+ *
+ * Implementation of a streaming encryptor/decryptor on top of the SPN block
+ * API.
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#include "SPN-1-0-stream.h"
+
+using namespace std;
+
+
+SPN_Stream::SPN_Stream(SPN& cipher, bool encrypt) : spn(cipher) {
+	encrypting = encrypt;
+	numPartial = 0;
+}
+
+/*
+ * Encryption outputs every complete block right away. Decryption always holds
+ * back the last complete block, since it may turn out to be the padding block
+ * that finalize() has to strip.
+ */
+size_t SPN_Stream::update(const unsigned char in[], size_t len, unsigned char out[]) {
+	size_t total = numPartial + len;
+	size_t keep = total % BLOCK_LEN;
+	if (!encrypting && keep == 0 && total > 0) { keep = BLOCK_LEN; }
+	size_t emit = total - keep; // bytes processed by this call, a multiple of BLOCK_LEN
+	size_t written = 0;
+
+	if (emit > 0 && numPartial > 0) {
+		// Complete the carried-over block first
+		size_t fill = BLOCK_LEN - numPartial;
+		for (size_t i = 0; i < fill; i++) {
+			partial[numPartial + i] = in[i];
+		}
+		if (encrypting) { spn.encrypt_blocks(partial, out, 1); }
+		else { spn.decrypt_blocks(partial, out, 1); }
+		in += fill;
+		len -= fill;
+		emit -= BLOCK_LEN;
+		written = BLOCK_LEN;
+		numPartial = 0;
+	}
+
+	// The aligned body goes straight from in to out
+	if (emit > 0) {
+		if (encrypting) { spn.encrypt_blocks(in, out + written, emit / BLOCK_LEN); }
+		else { spn.decrypt_blocks(in, out + written, emit / BLOCK_LEN); }
+		in += emit;
+		len -= emit;
+		written += emit;
+	}
+
+	// Carry the rest over
+	for (size_t i = 0; i < len; i++) {
+		partial[numPartial + i] = in[i];
+	}
+	numPartial += len;
+
+	return written;
+}
+
+int SPN_Stream::finalize(unsigned char out[]) {
+	if (encrypting) {
+		// PKCS#7: pad with n bytes of value n, a full block if already aligned
+		unsigned char pad = (unsigned char) (BLOCK_LEN - numPartial);
+		for (size_t i = numPartial; i < BLOCK_LEN; i++) {
+			partial[i] = pad;
+		}
+		spn.encrypt_blocks(partial, out, 1);
+		numPartial = 0;
+		return BLOCK_LEN;
+	}
+
+	if (numPartial != BLOCK_LEN) { return -1; }
+	numPartial = 0;
+
+	unsigned char last[BLOCK_LEN];
+	spn.decrypt_blocks(partial, last, 1);
+	int pad = last[BLOCK_LEN - 1];
+	if (pad < 1 || pad > BLOCK_LEN) { return -1; }
+	for (int i = BLOCK_LEN - pad; i < BLOCK_LEN; i++) {
+		if (last[i] != pad) { return -1; }
+	}
+	for (int i = 0; i < BLOCK_LEN - pad; i++) {
+		out[i] = last[i];
+	}
+	return BLOCK_LEN - pad;
+}
@@ -0,0 +1,41 @@
+/* SPN-1-0-stream.h
+ *
+ * Header file of a streaming encryptor/decryptor on top of the SPN block API.
+ * Data can be fed in chunks of any size; partial blocks are carried over to
+ * the next call, and the last block is padded with PKCS#7 so decryption gives
+ * back exactly the original bytes.
+ *
+ * Created by Khoa Nguyen on 03/16/2016.
+ */
+
+#ifndef __SPN_STREAM__
+#define __SPN_STREAM__
+
+#include "SPN-1-0.h"
+
+using namespace std;
+
+class SPN_Stream {
+
+public:
+
+	// Stream over cipher (which must outlive the stream) in ECB mode
+	SPN_Stream(SPN& cipher, bool encrypt);
+
+	// Feed len bytes. Writes at most len + BLOCK_LEN bytes to out and
+	// returns how many were written.
+	size_t update(const unsigned char in[], size_t len, unsigned char out[]);
+
+	// End of input. Writes at most BLOCK_LEN bytes to out and returns how many
+	// were written, or -1 if the data to decrypt is truncated or badly padded.
+	int finalize(unsigned char out[]);
+
+private:
+
+	SPN& spn;
+	bool encrypting;
+	unsigned char partial[BLOCK_LEN]; // bytes carried over to the next call
+	size_t numPartial;
+};
+
+#endif
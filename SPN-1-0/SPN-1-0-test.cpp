@@ -7,49 +7,973 @@
  */
 
 #include <fstream>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include "SPN-1-0.h"
 #include "SPN-1-0-debug.h"
+#include "SPN-1-0-image.h"
+#include "SPN-1-0-corpus.h"
+#include "SPN-1-0-analysis.h"
+#include "SPN-1-0-reader.h"
+#include "SPN-1-0-stream.h"
+#include "SPN-1-0-batch.h"
+#include "SPN-1-0-keycache.h"
+#include "SPN-1-0-static.h"
+#include "SPN-1-0-daemon.h"
 #include "opencv2/imgproc/imgproc.hpp"
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv2/core/types_c.h"
 
-#define NUM_CHANNELS 3 // number of color channels in each pixel of image
-
 using namespace std;
 using namespace cv;
 
 void generate_data();
 void testSPN_string();
 void testSPN_image();
+void testSPN_compiled();
+void testSPN_ctr();
+void testSPN_cbc();
+void testSPN_stream();
+void testSPN_static();
+void testSPN_sbox();
+void testSPN_schedule();
+void testSPN_reader();
+void testSPN_vectors();
+void testSPN_batch();
+void testSPN_keycache();
+void testSPN_keycache_lru();
+void testSPN_linear_attack();
+void testSPN_differential_attack();
+void testSPN_daemon();
+#ifdef SPN_STATS
+void testSPN_stats();
+#endif
 
 int main() {
+	testSPN_vectors();
+	testSPN_compiled();
+	testSPN_ctr();
+	testSPN_cbc();
+	testSPN_stream();
+	testSPN_static();
+	testSPN_sbox();
+	testSPN_schedule();
+	testSPN_reader();
+	testSPN_batch();
+	testSPN_keycache();
+	testSPN_keycache_lru();
+	testSPN_linear_attack();
+	testSPN_differential_attack();
+	testSPN_daemon();
+#ifdef SPN_STATS
+	testSPN_stats();
+#endif
 	generate_data();
 	testSPN_image();
     testSPN_string();
 	return 0;		 
 }
 
+// A new empty file in the temporary directory, so that tests leave nothing
+// behind in the source tree; empty if it can't be created
+static string temp_file(const char* name) {
+	const char* dir = getenv("TMPDIR");
+	string path = string(dir != NULL && dir[0] != '\0' ? dir : "/tmp") + "/" + name + ".XXXXXX";
+	vector<char> buf(path.begin(), path.end());
+	buf.push_back('\0');
+	int fd = mkstemp(&buf[0]);
+	if (fd < 0) { return ""; }
+	::close(fd);
+	return string(&buf[0]);
+}
+
+// Known-plaintext pairs for the attacks, as a binary corpus (SPN-1-0-corpus.h).
+// The corpus embeds the key schedule, so it only lives as long as the check.
 void generate_data() {
-	srand(time(NULL));
-	ofstream output;
-	output.open("data.csv");
-	int numDataPts = 64;
-	unsigned char in[numDataPts], *out;
-	for (int i = 0; i < numDataPts; i++) {
+	const uint64_t numPairs = 1 << 20;
+	SPN tmp(8);
+	tmp.set_num_threads(0);
+	string path = temp_file("data.spnc");
+	if (path.empty() || !SPN_write_corpus(tmp, path, numPairs, (uint64_t) time(NULL))) {
+		cout << "ERROR: Can't write data.spnc" << endl;
+		if (!path.empty()) { remove(path.c_str()); }
+		return;
+	}
+
+	// Read it back through the mapping and spot-check some pairs
+	SPN_Corpus corpus;
+	bool ok = corpus.open(path) && corpus.size() == numPairs;
+	SPN* cipher = ok ? corpus.make_cipher() : NULL;
+	for (uint64_t i = 0; ok && i < numPairs; i += 4099) {
+		unsigned char out[BLOCK_LEN];
+		cipher->encrypt_blocks(corpus.plaintexts() + i * BLOCK_LEN, out, 1);
+		ok = memcmp(out, corpus.ciphertexts() + i * BLOCK_LEN, BLOCK_LEN) == 0;
+	}
+	delete cipher;
+	corpus.close();
+	remove(path.c_str());
+	cout << "Corpus data.spnc: " << (ok ? "PASSED" : "FAILED") << endl;
+}
+
+// Known answers that every kernel must reproduce on every instruction set
+// this CPU supports. The blocks cycle through the vectors so that each one
+// lands in every lane of the wide registers and in the scalar tails.
+void testSPN_vectors() {
+	const unsigned char key[KEY_LEN] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+										0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+	const unsigned char perm[BLOCK_LEN] = {3, 6, 0, 5, 7, 1, 4, 2};
+	const unsigned char plain[3][BLOCK_LEN] = {
+		{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
+		{0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef},
+		{0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}};
+	const unsigned char cipher[3][BLOCK_LEN] = {
+		{0x2b, 0x9f, 0x71, 0x91, 0xdb, 0xca, 0xeb, 0x66},
+		{0x6e, 0x34, 0x9e, 0x90, 0x16, 0xad, 0xc8, 0xef},
+		{0xd4, 0x60, 0x8e, 0x6e, 0x24, 0x35, 0x14, 0x99}};
+	SPN_Kernel kernels[] = {SPN_KERNEL_SCALAR, SPN_KERNEL_SIMD, SPN_KERNEL_COLLAPSED,
+							SPN_KERNEL_FIXED, SPN_KERNEL_TTABLE, SPN_KERNEL_BITSLICE,
+							SPN_KERNEL_AUTO};
+	const int numBlocks = 37;
+	unsigned char in[numBlocks * BLOCK_LEN], out[numBlocks * BLOCK_LEN];
+	for (int s = 0; s < numBlocks; s++) {
+		memcpy(in + s * BLOCK_LEN, plain[s % 3], BLOCK_LEN);
+	}
+
+	SPN_Isa detected = SPN::get_isa();
+	SPN tmp(key, perm, 8);
+	tmp.compile_key();
+	for (int isa = SPN_ISA_SCALAR; isa <= SPN_ISA_AVX512; isa++) {
+		if (!SPN::set_isa((SPN_Isa) isa)) { continue; }
+		bool ok = true;
+		for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+			tmp.set_kernel(kernels[k]);
+			tmp.encrypt_blocks(in, out, numBlocks);
+			for (int s = 0; s < numBlocks; s++) {
+				ok = ok && memcmp(out + s * BLOCK_LEN, cipher[s % 3], BLOCK_LEN) == 0;
+			}
+			tmp.decrypt_blocks(out, out, numBlocks);
+			ok = ok && memcmp(out, in, numBlocks * BLOCK_LEN) == 0;
+		}
+		cout << "Test vectors, " << SPN::isa_name((SPN_Isa) isa) << ": "
+			 << (ok ? "PASSED" : "FAILED") << endl;
+	}
+	SPN::set_isa(detected);
+}
+
+// The compiled (collapsed) key and the bitsliced kernel must match the
+// round-by-round path exactly
+void testSPN_compiled() {
+	const int numBlocks = 1024;
+	int rounds[] = {4, 8, 16};
+	unsigned char *in = new unsigned char[numBlocks * BLOCK_LEN];
+	unsigned char *expected = new unsigned char[numBlocks * BLOCK_LEN];
+	unsigned char *out = new unsigned char[numBlocks * BLOCK_LEN];
+
+	for (int i = 0; i < numBlocks * BLOCK_LEN; i++) {
 		in[i] = (unsigned char) (rand() % 256);
 	}
 
-	SPN tmp(8);
-	out = tmp.encrypt_ECB_mode(in, numDataPts);
+	for (int t = 0; t < 3; t++) {
+		SPN tmp(rounds[t]);
+		bool ok = true;
+
+		tmp.set_kernel(SPN_KERNEL_SCALAR);
+		tmp.encrypt_blocks(in, expected, numBlocks);
+
+		// Bitsliced kernel, including a partial batch of 64 blocks
+		tmp.set_kernel(SPN_KERNEL_BITSLICE);
+		tmp.encrypt_blocks(in, out, numBlocks - 3);
+		ok = ok && memcmp(out, expected, (numBlocks - 3) * BLOCK_LEN) == 0;
+		tmp.decrypt_blocks(expected, out, numBlocks - 3);
+		ok = ok && memcmp(out, in, (numBlocks - 3) * BLOCK_LEN) == 0;
 
-	output << "Plain ," << "Cipher" << endl;
-	for (int i = 0; i < numDataPts; i++) {
-		output << (int) in[i] << "," << (int) out[i] << endl;
+		tmp.compile_key();
+		tmp.set_kernel(SPN_KERNEL_COLLAPSED);
+		tmp.encrypt_blocks(in, out, numBlocks);
+		ok = ok && memcmp(out, expected, numBlocks * BLOCK_LEN) == 0;
+
+		tmp.decrypt_blocks(expected, out, numBlocks);
+		ok = ok && memcmp(out, in, numBlocks * BLOCK_LEN) == 0;
+
+		cout << "Compiled key, " << dec << rounds[t] << " rounds: "
+			 << (ok ? "PASSED" : "FAILED") << endl;
 	}
 
+	delete [] in;
+	delete [] expected;
 	delete [] out;
+}
+
+// Any range of a CTR stream, decrypted on its own from a non-zero offset,
+// must match the same bytes of the whole stream; threaded or not
+void testSPN_ctr() {
+	const size_t len = 300 * 1024 + 5; // past the parallel threshold, ragged end
+	unsigned char key[KEY_LEN];
+	for (int i = 0; i < KEY_LEN; i++) {
+		key[i] = (unsigned char) (rand() % 256);
+	}
+	vector<unsigned char> plain(len), cipher(len), whole(len), part(len);
+	for (size_t i = 0; i < len; i++) {
+		plain[i] = (unsigned char) (rand() % 256);
+	}
+
+	SPN serial(key, 99, 8), threaded(key, 99, 8);
+	serial.set_num_threads(1);
+	threaded.set_num_threads(4);
+	serial.encrypt_CTR_mode(&plain[0], &cipher[0], len, 0xdecafbad, 7);
+	threaded.decrypt_CTR_mode(&cipher[0], &whole[0], len, 0xdecafbad, 7);
+	bool ok = memcmp(&whole[0], &plain[0], len) == 0;
+
+	// Block-aligned and unaligned starts, short and long ranges
+	size_t starts[] = {37 * BLOCK_LEN, 37 * BLOCK_LEN + 3, 4096 * BLOCK_LEN + 1};
+	size_t lengths[] = {1, BLOCK_LEN + 1, 1000, 270 * 1024};
+	for (int s = 0; s < 3; s++) {
+		for (int l = 0; l < 4; l++) {
+			size_t n = lengths[l];
+			if (starts[s] + n > len) { n = len - starts[s]; }
+			SPN& spn = (l == 3) ? threaded : serial; // the long range is split over the pool
+			spn.decrypt_CTR_mode(&cipher[starts[s]], &part[0], n, 0xdecafbad, 7, starts[s]);
+			ok = ok && memcmp(&part[0], &whole[starts[s]], n) == 0;
+		}
+	}
+
+	cout << "CTR ranges at an offset: " << (ok ? "PASSED" : "FAILED") << endl;
+}
+
+// Threaded CBC decryption must match the serial one, from an empty input
+// through partial and whole blocks up to one that spans many chunks
+void testSPN_cbc() {
+	int lengths[] = {0, 1, 7, 8, 9, 512 * 1024 + 3};
+	unsigned char key[KEY_LEN], iv[BLOCK_LEN];
+	for (int i = 0; i < KEY_LEN; i++) {
+		key[i] = (unsigned char) (rand() % 256);
+	}
+	for (int i = 0; i < BLOCK_LEN; i++) {
+		iv[i] = (unsigned char) (rand() % 256);
+	}
+	SPN serial(key, 5, 8), threaded(key, 5, 8);
+	serial.set_num_threads(1);
+	threaded.set_num_threads(4);
+	threaded.set_parallel_threshold(0); // even one block goes to the pool
+	bool ok = true;
+
+	for (int t = 0; t < 6; t++) {
+		int len = lengths[t];
+		int padded = (len + BLOCK_LEN - 1) / BLOCK_LEN * BLOCK_LEN;
+		vector<unsigned char> plain(len + 1);
+		for (int i = 0; i < len; i++) {
+			plain[i] = (unsigned char) (rand() % 256);
+		}
+
+		unsigned char* cipher = serial.encrypt_CBC_mode(&plain[0], len, iv);
+		unsigned char* expected = serial.decrypt_CBC_mode(cipher, padded, iv);
+		unsigned char* out = threaded.decrypt_CBC_mode(cipher, padded, iv);
+		ok = ok && memcmp(out, expected, padded) == 0 && memcmp(out, &plain[0], len) == 0;
+
+		delete [] cipher;
+		delete [] expected;
+		delete [] out;
+	}
+
+	cout << "CBC threaded decryption: " << (ok ? "PASSED" : "FAILED") << endl;
+}
+
+// Feed len bytes through a stream in random chunk sizes; returns the output length
+static int stream_through(SPN_Stream& stream, const unsigned char in[], size_t len,
+						  unsigned char out[]) {
+	size_t done = 0, written = 0;
+	while (done < len) {
+		size_t n = (size_t) (rand() % 100); // empty chunks included
+		if (n > len - done) { n = len - done; }
+		written += stream.update(in + done, n, out + written);
+		done += n;
+	}
+	int last = stream.finalize(out + written);
+	return last < 0 ? -1 : (int) written + last;
+}
+
+// SPN_Stream must give back exactly the bytes it was fed, however they are
+// chunked, and refuse truncated or badly padded ciphertext
+void testSPN_stream() {
+	size_t lengths[] = {0, 1, BLOCK_LEN - 1, BLOCK_LEN, BLOCK_LEN + 1, 100003};
+	unsigned char key[KEY_LEN];
+	for (int i = 0; i < KEY_LEN; i++) {
+		key[i] = (unsigned char) (rand() % 256);
+	}
+	SPN spn(key, 11, 8);
+	bool ok = true;
+
+	for (int t = 0; t < 6; t++) {
+		size_t len = lengths[t];
+		vector<unsigned char> plain(len + 1), cipher(len + 2 * BLOCK_LEN), out(len + 2 * BLOCK_LEN);
+		for (size_t i = 0; i < len; i++) {
+			plain[i] = (unsigned char) (rand() % 256);
+		}
+
+		SPN_Stream enc(spn, true);
+		int clen = stream_through(enc, &plain[0], len, &cipher[0]);
+		ok = ok && clen == (int) ((len / BLOCK_LEN + 1) * BLOCK_LEN);
+
+		SPN_Stream dec(spn, false);
+		int plen = stream_through(dec, &cipher[0], clen, &out[0]);
+		ok = ok && plen == (int) len && memcmp(&out[0], &plain[0], len) == 0;
+
+		SPN_Stream cut(spn, false);
+		ok = ok && stream_through(cut, &cipher[0], clen - 1, &out[0]) == -1;
+	}
+
+	// Last blocks whose padding is malformed: zero, too long, inconsistent
+	unsigned char bad[3][BLOCK_LEN] = {{0}, {0}, {0}};
+	bad[1][BLOCK_LEN - 1] = BLOCK_LEN + 1;
+	bad[2][BLOCK_LEN - 1] = 3;
+	bad[2][BLOCK_LEN - 2] = 3;
+	bad[2][BLOCK_LEN - 3] = 2;
+	for (int t = 0; t < 3; t++) {
+		unsigned char cipher[BLOCK_LEN], out[2 * BLOCK_LEN];
+		spn.encrypt_blocks(bad[t], cipher, 1);
+		SPN_Stream dec(spn, false);
+		ok = ok && stream_through(dec, cipher, BLOCK_LEN, out) == -1;
+	}
+
+	cout << "Stream round trip: " << (ok ? "PASSED" : "FAILED") << endl;
+}
+
+// Round-by-round reference of the complement-S-box cipher for any block
+// length: XOR, complement, gather; the last round skips the gather and is
+// followed by the whitening key
+static void static_reference(int blockLen, int rounds, const unsigned char* const subkeys[],
+							 const unsigned char perm[], const unsigned char in[],
+							 unsigned char out[]) {
+	unsigned char x[32], y[32];
+	memcpy(x, in, blockLen);
+	for (int r = 0; r < rounds; r++) {
+		for (int i = 0; i < blockLen; i++) { x[i] = (unsigned char) ~(x[i] ^ subkeys[r][i]); }
+		if (r == rounds - 1) { break; }
+		for (int i = 0; i < blockLen; i++) { y[i] = x[perm[i]]; }
+		memcpy(x, y, blockLen);
+	}
+	for (int i = 0; i < blockLen; i++) { out[i] = x[i] ^ subkeys[rounds][i]; }
+}
+
+// Check SPN_Static<BlockLen, Rounds> against the reference on numBlocks
+// random blocks, both directions
+template <int BlockLen, int Rounds>
+static bool check_static(int numBlocks) {
+	unsigned char keyBytes[Rounds + 1][BlockLen], perm[BlockLen];
+	const unsigned char* subkeys[Rounds + 1];
+	for (int r = 0; r < Rounds + 1; r++) {
+		for (int i = 0; i < BlockLen; i++) { keyBytes[r][i] = (unsigned char) (rand() % 256); }
+		subkeys[r] = keyBytes[r];
+	}
+	for (int i = 0; i < BlockLen; i++) { perm[i] = (unsigned char) i; }
+	for (int i = BlockLen - 1; i > 0; i--) {
+		int j = rand() % (i + 1);
+		unsigned char t = perm[i];
+		perm[i] = perm[j];
+		perm[j] = t;
+	}
+
+	vector<unsigned char> in(numBlocks * BlockLen), expected(numBlocks * BlockLen);
+	vector<unsigned char> out(numBlocks * BlockLen);
+	for (size_t i = 0; i < in.size(); i++) {
+		in[i] = (unsigned char) (rand() % 256);
+	}
+	for (int s = 0; s < numBlocks; s++) {
+		static_reference(BlockLen, Rounds, subkeys, perm, &in[s * BlockLen],
+						 &expected[s * BlockLen]);
+	}
+
+	SPN_Static<BlockLen, Rounds> kernel(subkeys, perm);
+	kernel.encrypt_blocks(&in[0], &out[0], numBlocks);
+	bool ok = out == expected;
+	kernel.decrypt_blocks(&expected[0], &out[0], numBlocks);
+	return ok && out == in;
+}
+
+// The word-wise 8- and 16-byte block operations and the generic byte-wise
+// ones must all compute the reference cipher
+void testSPN_static() {
+	bool ok = check_static<8, 4>(256) && check_static<8, 8>(256)
+		&& check_static<16, 4>(256) && check_static<16, 8>(256) && check_static<16, 16>(256)
+		&& check_static<12, 5>(256);
+	cout << "Static kernels, 8/12/16-byte blocks: " << (ok ? "PASSED" : "FAILED") << endl;
+}
+
+// A random S-box through the T-table and bitsliced kernels must match the
+// scalar path
+void testSPN_sbox() {
+	const int numBlocks = 1024;
+	unsigned char sbox[SBOX_SIZE];
+	unsigned char *in = new unsigned char[numBlocks * BLOCK_LEN];
+	unsigned char *expected = new unsigned char[numBlocks * BLOCK_LEN];
+	unsigned char *out = new unsigned char[numBlocks * BLOCK_LEN];
+	bool ok = true;
+
+	// Fisher-Yates shuffle of the identity
+	for (int i = 0; i < SBOX_SIZE; i++) {
+		sbox[i] = (unsigned char) i;
+	}
+	for (int i = SBOX_SIZE - 1; i > 0; i--) {
+		int j = rand() % (i + 1);
+		unsigned char t = sbox[i];
+		sbox[i] = sbox[j];
+		sbox[j] = t;
+	}
+	for (int i = 0; i < numBlocks * BLOCK_LEN; i++) {
+		in[i] = (unsigned char) (rand() % 256);
+	}
+
+	SPN tmp(8);
+	tmp.set_sbox(sbox);
+
+	tmp.set_kernel(SPN_KERNEL_SCALAR);
+	tmp.encrypt_blocks(in, expected, numBlocks);
+
+	tmp.set_kernel(SPN_KERNEL_TTABLE);
+	tmp.encrypt_blocks(in, out, numBlocks);
+	ok = ok && memcmp(out, expected, numBlocks * BLOCK_LEN) == 0;
+
+	tmp.decrypt_blocks(expected, out, numBlocks);
+	ok = ok && memcmp(out, in, numBlocks * BLOCK_LEN) == 0;
+
+	// The bitsliced circuit, including a partial batch of 64 blocks
+	tmp.set_kernel(SPN_KERNEL_BITSLICE);
+	tmp.encrypt_blocks(in, out, numBlocks - 3);
+	ok = ok && memcmp(out, expected, (numBlocks - 3) * BLOCK_LEN) == 0;
+	tmp.decrypt_blocks(expected, out, numBlocks - 3);
+	ok = ok && memcmp(out, in, (numBlocks - 3) * BLOCK_LEN) == 0;
+
+	cout << "Random S-box, T-table and bitsliced kernels: " << (ok ? "PASSED" : "FAILED") << endl;
+
+	delete [] in;
+	delete [] expected;
+	delete [] out;
+}
+
+// Exported schedules must import to the same cipher, custom S-box and
+// compiled key included, and tampered blobs must be turned away
+void testSPN_schedule() {
+	const int numBlocks = 64;
+	unsigned char key[KEY_LEN], sbox[SBOX_SIZE];
+	unsigned char in[numBlocks * BLOCK_LEN], expected[numBlocks * BLOCK_LEN];
+	unsigned char out[numBlocks * BLOCK_LEN];
+	bool ok = true;
+
+	for (int i = 0; i < KEY_LEN; i++) {
+		key[i] = (unsigned char) (rand() % 256);
+	}
+	for (int i = 0; i < numBlocks * BLOCK_LEN; i++) {
+		in[i] = (unsigned char) (rand() % 256);
+	}
+	for (int i = 0; i < SBOX_SIZE; i++) {
+		sbox[i] = (unsigned char) (i * 7 + 3); // odd multiplier: a bijection
+	}
+
+	for (int t = 0; t < 3; t++) {
+		SPN spn(key, 1234 + t, 8);
+		if (t == 1) { spn.compile_key(); }
+		if (t == 2) { spn.set_sbox(sbox); }
+		spn.encrypt_blocks(in, expected, numBlocks);
+
+		vector<unsigned char> blob(spn.schedule_size());
+		spn.export_schedule(&blob[0]);
+		SPN* copy = SPN::import_schedule(&blob[0], blob.size());
+		ok = ok && copy != NULL;
+		if (copy != NULL) {
+			copy->encrypt_blocks(in, out, numBlocks);
+			ok = ok && memcmp(out, expected, sizeof(out)) == 0;
+			copy->decrypt_blocks(expected, out, numBlocks);
+			ok = ok && memcmp(out, in, sizeof(out)) == 0;
+			delete copy;
+		}
+
+		// Unknown flag, a subkey that doesn't follow from the key, a
+		// truncated blob, and for the compiled key a wrong mask byte
+		vector<unsigned char> bad(blob);
+		bad[5] |= 0x80;
+		ok = ok && SPN::import_schedule(&bad[0], bad.size()) == NULL;
+		bad = blob;
+		bad[8 + KEY_LEN + 3] ^= 1;
+		ok = ok && SPN::import_schedule(&bad[0], bad.size()) == NULL;
+		ok = ok && SPN::import_schedule(&blob[0], blob.size() - 1) == NULL;
+		if (t == 1) {
+			bad = blob;
+			bad[bad.size() - 3 * BLOCK_LEN - 1] ^= 1;
+			ok = ok && SPN::import_schedule(&bad[0], bad.size()) == NULL;
+		}
+	}
+
+	cout << "Schedule export/import: " << (ok ? "PASSED" : "FAILED") << endl;
+}
+
+// Random reads through SPN_Reader must match the plaintext, touching only
+// the pages they need
+void testSPN_reader() {
+	const int numBlocks = 64 * 1024;
+	unsigned char *in = new unsigned char[numBlocks * BLOCK_LEN];
+	unsigned char *cipher = new unsigned char[numBlocks * BLOCK_LEN];
+	unsigned char out[1000];
+	bool ok = true;
+
+	for (int i = 0; i < numBlocks * BLOCK_LEN; i++) {
+		in[i] = (unsigned char) (rand() % 256);
+	}
+
+	unsigned char key[KEY_LEN] = {0};
+	SPN tmp(key, 7, 8);
+	tmp.encrypt_blocks(in, cipher, numBlocks);
+	string path = temp_file("reader.bin");
+	ofstream output(path.c_str(), ios::binary);
+	output.write((const char*) cipher, numBlocks * BLOCK_LEN);
 	output.close();
+
+	SPN_Reader reader(tmp);
+	ok = !path.empty() && reader.open(path);
+	for (int t = 0; ok && t < 100; t++) {
+		int pos = rand() % (numBlocks * BLOCK_LEN);
+		size_t len = reader.read(pos, out, sizeof(out));
+		ok = memcmp(out, in + pos, len) == 0;
+	}
+	ok = ok && reader.misses() <= 200;
+	reader.close();
+	if (!path.empty()) { remove(path.c_str()); }
+
+	cout << "Random-access reader: " << (ok ? "PASSED" : "FAILED") << endl;
+
+	delete [] in;
+	delete [] cipher;
+}
+
+// Records under many keys, one of them with its own S-box (run through its
+// SPN), must come out as if each key had encrypted its own record
+void testSPN_batch() {
+	const int numKeys = 16, numRecords = 200, maxBlocks = 4;
+	unsigned char sbox[SBOX_SIZE];
+	for (int i = 0; i < SBOX_SIZE; i++) {
+		sbox[i] = (unsigned char) (7 * i + 3);
+	}
+	unsigned char in[numRecords][maxBlocks * BLOCK_LEN];
+	unsigned char out[numRecords][maxBlocks * BLOCK_LEN];
+	unsigned char expected[maxBlocks * BLOCK_LEN];
+	bool ok = true;
+
+	SPN* spns[numKeys];
+	SPN_KeyBatch batch;
+	for (int k = 0; k < numKeys; k++) {
+		unsigned char key[KEY_LEN];
+		for (int i = 0; i < KEY_LEN; i++) { key[i] = (unsigned char) (rand() % 256); }
+		spns[k] = new SPN(key, k, 4 + k);
+		if (k == 5) { spns[k]->set_sbox(sbox); }
+		batch.add_key(*spns[k]);
+	}
+
+	SPN_BatchRecord records[numRecords];
+	for (int r = 0; r < numRecords; r++) {
+		for (int i = 0; i < maxBlocks * BLOCK_LEN; i++) {
+			in[r][i] = (unsigned char) (rand() % 256);
+		}
+		records[r].key = rand() % numKeys;
+		records[r].in = in[r];
+		records[r].out = out[r];
+		records[r].nblocks = rand() % (maxBlocks + 1);
+	}
+
+	ok = batch.encrypt(records, numRecords);
+	for (int r = 0; ok && r < numRecords; r++) {
+		spns[records[r].key]->encrypt_blocks(in[r], expected, records[r].nblocks);
+		ok = memcmp(out[r], expected, records[r].nblocks * BLOCK_LEN) == 0;
+	}
+
+	// Decrypt in place
+	for (int r = 0; r < numRecords; r++) {
+		records[r].in = out[r];
+	}
+	ok = ok && batch.decrypt(records, numRecords);
+	for (int r = 0; ok && r < numRecords; r++) {
+		ok = memcmp(out[r], in[r], records[r].nblocks * BLOCK_LEN) == 0;
+	}
+
+	cout << "Multi-key batch: " << (ok ? "PASSED" : "FAILED") << endl;
+
+	for (int k = 0; k < numKeys; k++) {
+		delete spns[k];
+	}
+}
+
+// Threads sharing a cache smaller than the key set must always get the
+// right context, and every lookup must be counted as a hit or a miss
+void testSPN_keycache() {
+	const int numKeys = 48, numThreads = 4, lookups = 2000;
+	unsigned char keys[numKeys][KEY_LEN];
+	unsigned char expected[numKeys][BLOCK_LEN];
+	const unsigned char plain[BLOCK_LEN] = {1, 2, 3, 4, 5, 6, 7, 8};
+
+	for (int k = 0; k < numKeys; k++) {
+		for (int i = 0; i < KEY_LEN; i++) { keys[k][i] = (unsigned char) (rand() % 256); }
+		SPN tmp(keys[k], k, 8);
+		tmp.encrypt_blocks(plain, expected[k], 1);
+	}
+
+	SPN_KeyCache cache(16, 4);
+	atomic<int> wrong(0);
+	vector<thread> threads;
+	for (int t = 0; t < numThreads; t++) {
+		threads.push_back(thread([&, t]() {
+			unsigned int seed = t + 1;
+			for (int i = 0; i < lookups; i++) {
+				int k = rand_r(&seed) % numKeys;
+				shared_ptr<SPN> spn = cache.get(keys[k], k, 8);
+				unsigned char out[BLOCK_LEN];
+				spn->encrypt_blocks(plain, out, 1);
+				if (memcmp(out, expected[k], BLOCK_LEN) != 0) { wrong++; }
+			}
+		}));
+	}
+	for (int t = 0; t < numThreads; t++) {
+		threads[t].join();
+	}
+
+	bool ok = wrong == 0 && cache.size() <= 16
+		&& cache.hits() + cache.misses() == (uint64_t) numThreads * lookups;
+	cout << "Key cache: " << (ok ? "PASSED" : "FAILED") << " (" << dec << cache.hits()
+		 << " hits, " << cache.misses() << " misses)" << endl;
+}
+
+// The shards together hold exactly the capacity, whether there are more
+// shards than contexts or fewer, and a full shard evicts its least
+// recently used context
+void testSPN_keycache_lru() {
+	const unsigned char key[KEY_LEN] = {0};
+	int loads = 0;
+	function<SPN*(uint64_t)> load = [&](uint64_t id) {
+		loads++;
+		return new SPN(key, (unsigned int) id, 4);
+	};
+	bool ok = true;
+
+	size_t capacities[] = {1, 3, 10, 37};
+	for (int c = 0; c < 4; c++) {
+		SPN_KeyCache cache(capacities[c], 16);
+		for (uint64_t id = 0; id < 1000; id++) { cache.get(id, load); }
+		ok = ok && cache.size() == capacities[c] && cache.evictions() == 1000 - capacities[c];
+	}
+
+	// One shard of 3: ids 1 2 3, touch 1, then 4 evicts 2; touch 3, then
+	// 2 comes back and evicts 1; 4 is still there and 1 must be reloaded
+	SPN_KeyCache cache(3, 1);
+	uint64_t ids[] = {1, 2, 3, 1, 4, 3, 2, 4, 1};
+	int expectedLoads[] = {1, 2, 3, 3, 4, 4, 5, 5, 6};
+	loads = 0;
+	for (int i = 0; i < 9; i++) {
+		cache.get(ids[i], load);
+		ok = ok && loads == expectedLoads[i];
+	}
+
+	cout << "Key cache capacity and LRU order: " << (ok ? "PASSED" : "FAILED") << endl;
+}
+
+/******************************************************************************
+ *                              CRYPTANALYSIS                                 *
+ ******************************************************************************
+ * Both attacks run on 4 rounds under a fixed key and the weak S-box of
+ * SPN-attack (NOT with 32 entries swapped), with 2^16 pairs. Everything is
+ * drawn from fixed seeds, so the ranking is the same on every run; the true
+ * whitening subkey byte must be among the best ATTACK_TOP of 256 guesses.
+ */
+#define ATTACK_PAIRS (1 << 16)
+#define ATTACK_TOP 5
+
+// 4-round cipher with a weak S-box, the same on every run
+static SPN* weak_cipher() {
+	unsigned char key[KEY_LEN];
+	for (int i = 0; i < KEY_LEN; i++) { key[i] = (unsigned char) (17 * i + 5); }
+	SPN* spn = new SPN(key, 1, 4);
+
+	unsigned char sbox[SBOX_SIZE];
+	for (int x = 0; x < SBOX_SIZE; x++) { sbox[x] = (unsigned char) ~x; }
+	uint32_t state = 12345;
+	for (int i = 0; i < 32; i++) {
+		state = state * 1103515245 + 12345;
+		int x = (state >> 16) % SBOX_SIZE;
+		state = state * 1103515245 + 12345;
+		int y = (state >> 16) % SBOX_SIZE;
+		unsigned char t = sbox[x];
+		sbox[x] = sbox[y];
+		sbox[y] = t;
+	}
+	spn->set_sbox(sbox);
+	return spn;
+}
+
+// Every attacked byte ranks its true value among the first ATTACK_TOP
+static bool attack_ranks(const SPN& spn, const vector<vector<SPN_KeyCandidate> >& cand) {
+	unsigned char lastKey[BLOCK_LEN];
+	spn.get_subkey(spn.get_num_rounds(), lastKey);
+	int attacked = 0;
+	for (int j = 0; j < BLOCK_LEN; j++) {
+		if (cand[j].empty()) { continue; }
+		attacked++;
+		size_t rank = 0;
+		while (rank < cand[j].size() && cand[j][rank].key != lastKey[j]) { rank++; }
+		if (rank >= ATTACK_TOP) { return false; }
+	}
+	return attacked > 0;
+}
+
+void testSPN_linear_attack() {
+	SPN* spn = weak_cipher();
+	vector<unsigned char> pairs(2 * ATTACK_PAIRS * BLOCK_LEN);
+	SPN_random_blocks(&pairs[0], ATTACK_PAIRS, 1, 0);
+	spn->encrypt_blocks(&pairs[0], &pairs[ATTACK_PAIRS * BLOCK_LEN], ATTACK_PAIRS);
+
+	SPN_Analysis analysis(*spn);
+	vector<SPN_LinearApprox> approx = analysis.find_linear_approximations(4);
+	vector<vector<SPN_KeyCandidate> > cand = analysis.linear_attack(approx,
+		&pairs[0], &pairs[ATTACK_PAIRS * BLOCK_LEN], ATTACK_PAIRS);
+
+	bool ok = attack_ranks(*spn, cand);
+	cout << "Linear attack, 4 rounds: " << (ok ? "PASSED" : "FAILED") << endl;
+	delete spn;
+}
+
+void testSPN_differential_attack() {
+	SPN* spn = weak_cipher();
+	SPN_Analysis analysis(*spn);
+	vector<SPN_Differential> diff = analysis.find_differentials(4);
+	vector<vector<SPN_KeyCandidate> > cand =
+		analysis.differential_attack(*spn, diff, ATTACK_PAIRS, 1);
+
+	bool ok = attack_ranks(*spn, cand);
+	cout << "Differential attack, 4 rounds: " << (ok ? "PASSED" : "FAILED") << endl;
+	delete spn;
+}
+
+/******************************************************************************
+ *                                 DAEMON                                     *
+ ******************************************************************************
+ * Runs ./SPN-daemon (build.sh builds it next to this program) on a socket in
+ * the temporary directory and talks to it over raw sockets, so that a test
+ * can pipeline requests, half-close and hang up the way SPN_Client never does.
+ */
+#define DAEMON_BIG_REQUESTS 384 // 1 MiB requests pipelined without reading
+
+// Start the daemon on one schedule; 0 if it does not come up
+static pid_t start_daemon(const string& socketPath, const string& schedule) {
+	pid_t pid = fork();
+	if (pid == 0) {
+		int devnull = open("/dev/null", O_WRONLY);
+		if (devnull >= 0) { dup2(devnull, 1); }
+		execl("./SPN-daemon", "./SPN-daemon", "serve", socketPath.c_str(), schedule.c_str(),
+			  (char*) NULL);
+		_exit(127);
+	}
+	// The socket replaces the empty file temp_file() left at its path
+	for (int t = 0; pid > 0 && t < 200; t++) {
+		struct stat st;
+		if (stat(socketPath.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) { return pid; }
+		if (waitpid(pid, NULL, WNOHANG) != 0) { return 0; }
+		usleep(10000);
+	}
+	if (pid > 0) {
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+	}
+	return 0;
+}
+
+static int connect_daemon(const string& socketPath) {
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd >= 0 && ::connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Send one encryption request of len zero bytes under key context 0
+static bool send_request(int fd, uint32_t id, uint32_t len) {
+	SPN_DaemonHeader h;
+	h.id = id;
+	h.op = SPN_OP_ENCRYPT;
+	h.status = 0;
+	h.key = 0;
+	h.length = len;
+	vector<unsigned char> buf(SPN_DAEMON_HEADER_LEN + len, 0);
+	SPN_encode_header(h, &buf[0]);
+	for (size_t pos = 0; pos < buf.size(); ) {
+		ssize_t n = send(fd, &buf[pos], buf.size() - pos, MSG_NOSIGNAL);
+		if (n <= 0) { return false; }
+		pos += (size_t) n;
+	}
+	return true;
+}
+
+// Ids of the answers read until the daemon hangs up, max answers arrived,
+// or nothing came for timeoutMs
+static vector<uint32_t> read_answers(int fd, size_t max, int timeoutMs) {
+	vector<uint32_t> ids;
+	vector<unsigned char> in;
+	unsigned char buf[64 * 1024];
+	while (ids.size() < max) {
+		struct pollfd p;
+		p.fd = fd;
+		p.events = POLLIN;
+		if (poll(&p, 1, timeoutMs) <= 0) { break; }
+		ssize_t n = recv(fd, buf, sizeof(buf), 0);
+		if (n <= 0) { break; }
+		in.insert(in.end(), buf, buf + n);
+
+		size_t pos = 0;
+		SPN_DaemonHeader h;
+		while (in.size() - pos >= SPN_DAEMON_HEADER_LEN) {
+			SPN_decode_header(&in[pos], h);
+			if (in.size() - pos - SPN_DAEMON_HEADER_LEN < h.length) { break; }
+			ids.push_back(h.id);
+			pos += SPN_DAEMON_HEADER_LEN + h.length;
+		}
+		in.erase(in.begin(), in.begin() + pos);
+	}
+	return ids;
+}
+
+// Peak resident set of a process in KiB, from /proc; 0 if unknown
+static size_t peak_rss_kb(pid_t pid) {
+	ostringstream name;
+	name << "/proc/" << pid << "/status";
+	ifstream status(name.str().c_str());
+	string line;
+	while (getline(status, line)) {
+		if (line.compare(0, 6, "VmHWM:") == 0) { return (size_t) strtoull(line.c_str() + 6, NULL, 10); }
+	}
+	return 0;
+}
+
+void testSPN_daemon() {
+	if (access("./SPN-daemon", X_OK) != 0) {
+		cout << "Daemon: SKIPPED (./SPN-daemon not built)" << endl;
+		return;
+	}
+	const unsigned char key[KEY_LEN] = {0};
+	SPN spn(key, 1, 8);
+	spn.compile_key();
+	vector<unsigned char> blob(spn.schedule_size());
+	spn.export_schedule(&blob[0]);
+	string schedule = temp_file("daemon.key");
+	string socketPath = temp_file("daemon.sock");
+	ofstream output(schedule.c_str(), ios::binary);
+	output.write((const char*) &blob[0], blob.size());
+	output.close();
+
+	pid_t pid = start_daemon(socketPath, schedule);
+	bool ok = pid != 0;
+
+	// A client that pipelines requests and shuts down its sending side
+	// still gets every answer, then the daemon hangs up
+	int fd = ok ? connect_daemon(socketPath) : -1;
+	ok = fd >= 0;
+	for (uint32_t i = 0; ok && i < 3; i++) { ok = send_request(fd, i, 2 * BLOCK_LEN); }
+	if (ok) {
+		shutdown(fd, SHUT_WR);
+		vector<uint32_t> ids = read_answers(fd, 4, 2000);
+		ok = ids.size() == 3 && ids[0] == 0 && ids[1] == 1 && ids[2] == 2;
+	}
+	if (fd >= 0) { ::close(fd); }
+
+	// Shutting down without a request gets a hang-up, not a wait
+	fd = ok ? connect_daemon(socketPath) : -1;
+	if (fd >= 0) {
+		shutdown(fd, SHUT_WR);
+		ok = read_answers(fd, 1, 2000).empty();
+		::close(fd);
+	}
+
+	// The answer of a client that hung up must not reach the next client,
+	// even if that one got the same fd
+	fd = ok ? connect_daemon(socketPath) : -1;
+	ok = fd >= 0 && send_request(fd, 7, BLOCK_LEN);
+	if (fd >= 0) { ::close(fd); }
+	usleep(20000);
+	fd = ok ? connect_daemon(socketPath) : -1;
+	ok = fd >= 0 && send_request(fd, 9, BLOCK_LEN);
+	if (ok) {
+		vector<uint32_t> ids = read_answers(fd, 2, 500);
+		ok = ids.size() == 1 && ids[0] == 9;
+	}
+	if (fd >= 0) { ::close(fd); }
+
+	// A client that sends without reading is paused instead of buffered:
+	// the daemon's memory stays well below what was sent, and every answer
+	// still arrives once the client reads
+	fd = ok ? connect_daemon(socketPath) : -1;
+	ok = fd >= 0;
+	if (ok) {
+		atomic<bool> sent(false);
+		thread sender([&]() {
+			bool all = true;
+			for (uint32_t i = 0; all && i < DAEMON_BIG_REQUESTS; i++) { all = send_request(fd, i, 1 << 20); }
+			sent = all;
+		});
+		usleep(500000);
+		size_t ids = read_answers(fd, DAEMON_BIG_REQUESTS, 5000).size();
+		sender.join();
+		size_t peakKb = peak_rss_kb(pid);
+		ok = sent && ids == DAEMON_BIG_REQUESTS && peakKb > 0
+			&& peakKb < (size_t) DAEMON_BIG_REQUESTS * 1024 / 2;
+		::close(fd);
+	}
+
+	if (pid != 0) {
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+	}
+	remove(schedule.c_str());
+	remove(socketPath.c_str());
+	cout << "Daemon half-close, fd reuse and backpressure: " << (ok ? "PASSED" : "FAILED") << endl;
+}
+
+#ifdef SPN_STATS
+// Bytes are counted once, at the public entry point, as the caller passed
+// them: padding and the internal bulk calls behind ECB must not add to it
+void testSPN_stats() {
+	const unsigned char key[KEY_LEN] = {0};
+	SPN spn(key, 1, 4);
+	unsigned char in[80] = {0};
+	unsigned char out[80];
+	bool ok = true;
+
+	spn.reset_stats();
+	delete[] spn.encrypt_ECB_mode(in, 77);
+	ok = ok && spn.stats_snapshot().bytes == 77;
+
+	int outLen = 0;
+	spn.reset_stats();
+	delete[] spn.encrypt_ECB_mode(in, 77, outLen);
+	ok = ok && outLen == 80 && spn.stats_snapshot().bytes == 77;
+
+	spn.reset_stats();
+	spn.encrypt_blocks(in, out, 2);
+	SPN_Stats snap = spn.stats_snapshot();
+	ok = ok && snap.bytes == 2 * BLOCK_LEN && snap.blocks == 2;
+
+	cout << "Stats byte counts: " << (ok ? "PASSED" : "FAILED") << endl;
 }
+#endif
 
 void testSPN_string() {
     SPN_Debug tmp(8);
@@ -70,18 +994,19 @@ void testSPN_string() {
         cout << "--------------------------------------------------" << endl;
         cout << "* ENCRYPTION *************************************" << endl;
         cout << "--------------------------------------------------" << endl;
-        unsigned char* cipher = tmp.encrypt_ECB_mode(p, plaintext.length());
+        int cipherLen, plainLen;
+        unsigned char* cipher = tmp.encrypt_ECB_mode(p, plaintext.length(), cipherLen);
         cout << endl;
         
         cout << "--------------------------------------------------" << endl;
         cout << "* DECRYPTION *************************************" << endl;
         cout << "--------------------------------------------------" << endl;
-        int cipherLen = plaintext.length();
-        if (plaintext.length() % BLOCK_LEN != 0) {
-            cipherLen = cipherLen - (plaintext.length() % BLOCK_LEN) + BLOCK_LEN;
-        }
-        tmp.decrypt_ECB_mode(cipher, cipherLen);
+        unsigned char* decrypted = tmp.decrypt_ECB_mode(cipher, cipherLen, plainLen);
+        bool ok = decrypted != NULL && plainLen == (int) plaintext.length()
+            && memcmp(decrypted, p, plainLen) == 0;
+        cout << "Round trip: " << (ok ? "PASSED" : "FAILED") << endl;
         delete [] cipher;
+        delete [] decrypted;
         cout << endl;
         
         cout << "Continue? (y/n)" << endl;
@@ -96,6 +1021,7 @@ void testSPN_string() {
 
 void testSPN_image() {
 	SPN newSPN(8);
+	newSPN.set_num_threads(0); // one worker per core for big images
 	string filename;
 	cout << "Enter an image file's name: " << endl;
 	getline(cin, filename);
@@ -106,62 +1032,27 @@ void testSPN_image() {
 		return;
 	}
 
-	int len = plain.rows * plain.cols;
-	unsigned char **tmp_plain = new unsigned char*[NUM_CHANNELS];
-	for (int i = 0; i < NUM_CHANNELS; i++) {
-		tmp_plain[i] = new unsigned char[len];
-	}
-	unsigned char **tmp_encrypted = new unsigned char*[NUM_CHANNELS];
-	int currIndex = 0;
-	
-	for (int i = 0; i < plain.rows; i++) {
-		for (int j = 0; j < plain.cols; j++) {
-			for (int k = 0; k < NUM_CHANNELS; k++) {
-				tmp_plain[k][currIndex] = plain.at<Vec3b>(i, j)[k];
-			}
-			currIndex++;
-		}
-	}
+	// Pixels are encrypted interleaved, straight out of the Mat's buffer
+	Mat encrypted, decrypted;
+	SPN_encrypt_image(newSPN, plain, encrypted);
+	SPN_decrypt_image(newSPN, encrypted, decrypted);
 
-	for (int i = 0; i < NUM_CHANNELS; i++) {
-		tmp_encrypted[i] = newSPN.encrypt_ECB_mode(tmp_plain[i], len);
-	}
-	
-	Mat encrypted;
-	encrypted.create(plain.rows + 1, plain.cols, plain.type());
-
-	int row = 0, cipherLen = len;
-	currIndex = 0;
-	if (len % BLOCK_LEN != 0) {
-		cipherLen = cipherLen - (len % BLOCK_LEN) + BLOCK_LEN;
-	}
-	
-	for (int i = 0; i < cipherLen; i++) {
-		if (i % plain.cols == 0) { currIndex = 0; }
-		else { currIndex++;	}
-		row = (int) i / plain.cols;
-		for (int k = 0; k < NUM_CHANNELS; k++) {
-			encrypted.at<Vec3b>(row, currIndex)[k] = tmp_encrypted[k][i];
-		}
-	}
+	bool ok = encrypted.size() == plain.size() &&
+		memcmp(decrypted.data, plain.data, plain.total() * plain.elemSize()) == 0;
+	cout << "Image round trip: " << (ok ? "PASSED" : "FAILED") << endl;
 
 	namedWindow("orig");
 	imshow("orig", plain);
     namedWindow("encrypted");
     imshow("encrypted", encrypted);
 
+	// JPEG would destroy the ciphertext; keep it in a lossless container
 	string resultFile(filename);
-	resultFile += "_result.jpg";
-	imwrite(resultFile, encrypted);
-
-	for (int i = 0; i < NUM_CHANNELS; i++) {
-		delete [] tmp_encrypted[i];
-	}
-
-	for (int i = 0; i < NUM_CHANNELS; i++) {
-		delete [] tmp_plain[i];
-	}
-
-	delete [] tmp_encrypted;
-	delete [] tmp_plain;
+	resultFile += ".spni";
+	Mat loaded;
+	ok = SPN_save_image(newSPN, plain, resultFile, SPN_IMAGE_CTR, (uint32_t) time(NULL))
+		&& SPN_load_image(newSPN, resultFile, loaded)
+		&& loaded.type() == plain.type() && loaded.size() == plain.size()
+		&& memcmp(loaded.data, plain.data, plain.total() * plain.elemSize()) == 0;
+	cout << "Encrypted image container: " << (ok ? "PASSED" : "FAILED") << endl;
 }
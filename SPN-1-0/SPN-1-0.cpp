@@ -6,20 +6,49 @@
  */
 
 #include "SPN-1-0.h"
+#include "SPN-1-0-pool.h"
+#include "SPN-1-0-static.h"
 #include <iomanip>
+#include <algorithm>
+#include <sstream>
+#include <cstring>
+#include <stdint.h>
+
+#include <cstdlib>
+
+// The SIMD kernels are compiled per instruction set with target attributes
+// and picked at run time, so the build itself needs no -march flag
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SPN_X86 1
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
+/*
+ * Tracing policies for SPN_encrypt()/SPN_decrypt(). SPN_NoTrace has empty
+ * inline members, so its instantiation is the plain round loop.
+ * SPN_HookTrace forwards every trace point to an SPN_Tracer.
+ */
+struct SPN_NoTrace {
+	inline void begin_block(bool) {}
+	inline void trace(const char*, int, const unsigned char*) {}
+};
+
+struct SPN_HookTrace {
+	SPN_Tracer* tracer;
+	SPN_HookTrace(SPN_Tracer* t) : tracer(t) {}
+	inline void begin_block(bool encrypt) { tracer->begin_block(encrypt); }
+	inline void trace(const char* stage, int r, const unsigned char* block) {
+		tracer->trace(stage, r, block);
+	}
+};
+
 
 // Default constructor: Random key, min# of rounds = 4
 SPN::SPN(int nr) {
-    // Make sure number of rounds >= 4
-	if (nr < 4) {
-		numRounds = 4;
-	}
-	else {
-		numRounds = nr;
-	}
+	init(nr);
+	verbose = true;
 
     // Random key generated
 	cout << "--------------- RANDOM KEY: ----------------------" << endl;
@@ -38,27 +67,116 @@ SPN::SPN(int nr) {
 		
     // Generate Permutation Matrix
 	cout << "--------------- GENERATED PERMUTATION: -----------" << endl;
-	generate_permutation_matrix();
+	generate_permutation_matrix(time(NULL));
+	setup_kernels();
 
 	cout << "--------------------------------------------------" << endl;
 }
 
+// Explicit key and permutation seed, nothing is printed
+SPN::SPN(const unsigned char k[KEY_LEN], unsigned int seed, int nr) {
+	init(nr);
+	verbose = false;
+
+	key = new unsigned char[KEY_LEN];
+	for (int i = 0; i < KEY_LEN; i++) {
+		key[i] = k[i];
+	}
+	generate_subkeys();
+	generate_permutation_matrix(seed);
+	setup_kernels();
+}
+
+// Explicit key and explicit permutation, nothing is printed
+SPN::SPN(const unsigned char k[KEY_LEN], const unsigned char (&perm)[BLOCK_LEN], int nr) {
+	init(nr);
+	verbose = false;
+
+	key = new unsigned char[KEY_LEN];
+	for (int i = 0; i < KEY_LEN; i++) {
+		key[i] = k[i];
+	}
+	generate_subkeys();
+	set_permutation(perm);
+	setup_kernels();
+}
+
+// Shared constructor setup: round count and engine defaults
+void SPN::init(int nr) {
+    // Make sure number of rounds >= 4
+	if (nr < 4) {
+		numRounds = 4;
+	}
+	else {
+		numRounds = nr;
+	}
+	kernel = SPN_KERNEL_AUTO;
+	compiled = false;
+	pool = NULL;
+	ownsPool = false;
+	fixedKernel = NULL;
+	shuffleKeys = NULL;
+	shuffleKeysInverse = NULL;
+	tTable = NULL;
+	tTableInverse = NULL;
+	tracer = NULL;
+	reset_stats();
+	parallelThreshold = SPN_PARALLEL_THRESHOLD;
+
+	// Default S-box: bitwise complement, which is its own inverse
+	for (int x = 0; x < SBOX_SIZE; x++) {
+		sBox[x] = (unsigned char) ~x;
+		sBoxInverse[x] = (unsigned char) ~x;
+	}
+	complementSbox = true;
+}
+
 /*
 // Destructor
 // Delete all data members that are dynamically allocated of the SPN object
 
 */
 SPN::~SPN() {
+// Stop the workers
+	if (ownsPool) { delete pool; }
+	delete fixedKernel;
+	delete [] shuffleKeys;
+	delete [] shuffleKeysInverse;
+	delete [] tTable;
+	delete [] tTableInverse;
+
 // Destroy key
 	delete [] key;
 	
 // Destroy subkeys	
-	for (int i = 0; i < numRounds; ++i) {
+	for (int i = 0; i < numRounds + 1; ++i) {
 		delete [] subkeys[i];
 	}
 	delete [] subkeys;
 }
 
+// Build the kernels that depend on subkeys and pi_P()
+void SPN::setup_kernels() {
+	fixedKernel = make_static_kernel<BLOCK_LEN>(numRounds, subkeys, pIndex);
+	update_ttables();
+	generate_anf();
+
+	// Folded keys of the SIMD kernel: XOR and complement in one, and the
+	// last round merged with the whitening key (see SIMD KERNEL)
+	shuffleKeys = new uint64_t[numRounds];
+	shuffleKeysInverse = new uint64_t[numRounds];
+	for (int r = 0; r < numRounds; r++) {
+		uint64_t k;
+		memcpy(&k, subkeys[r], BLOCK_LEN);
+		shuffleKeys[r] = ~k;
+		if (r < numRounds - 1) { shuffleKeysInverse[numRounds - 1 - r] = ~k; }
+	}
+	uint64_t whitening;
+	memcpy(&whitening, subkeys[numRounds], BLOCK_LEN);
+	shuffleKeys[numRounds - 1] ^= whitening;
+	shuffleKeysInverse[0] = shuffleKeys[numRounds - 1];
+}
+
 // Key schedule: A simple function for the key schedule is that for subkey of round r, subkey K_r is a copy of the original key starting from byte 3i + 1, wrapped around if necessary. This is not a secure way to generate key in practice. It's good to demonstrate linear cryptanalysis, however.
 void SPN::generate_subkeys() {
 	subkeys = new unsigned char*[numRounds + 1];
@@ -67,8 +185,10 @@ void SPN::generate_subkeys() {
 		for (int j = 0; j < BLOCK_LEN; j++) {
 			subkeys[i][j] = key[(j + (3 * i + 1)) % KEY_LEN];
 		}
-		printArray(subkeys[i], BLOCK_LEN);
-		cout << endl;
+		if (verbose) {
+			printArray(subkeys[i], BLOCK_LEN);
+			cout << endl;
+		}
 	}
 }
 
@@ -77,13 +197,37 @@ void SPN::generate_subkeys() {
  * Pre: a block of input characters of length BLOCK_LEN
  * Post: a block of output characters of length BLOCK_LEN, each of which is the result of mapping the corresponding input character through the substitution function
  * Note: Substitution pi_S(): A simple function for substitution is to use the bit-flipped version of each input[i]. For example,  0000 0001 (0x01) becomes 1111 1110 (FE) (bit flipped). This can be improved greatly by using GF(2^8) and maximum-distance-separable (MDS) matrix.
+ * The mapping is a 256-entry table, so a stronger S-box can be plugged in with set_sbox(); decryption looks up the inverse table.
  */
-void SPN::pi_S(const unsigned char* input, unsigned char substituted[]) {
+void SPN::pi_S(const unsigned char* input, unsigned char substituted[], bool encrypt) {
+	SPN_STAT_TIME(subsCycles);
+	const unsigned char* table = encrypt ? sBox : sBoxInverse;
 	for (int i = 0; i < BLOCK_LEN; i++) {
-		substituted[i] = ~input[i];
+		substituted[i] = table[input[i]];
 	}
 }
-// TODO: improve S-boxes
+
+// Replace the S-box and derive its inverse
+bool SPN::set_sbox(const unsigned char sbox[SBOX_SIZE]) {
+	bool seen[SBOX_SIZE] = {false};
+	for (int x = 0; x < SBOX_SIZE; x++) {
+		if (seen[sbox[x]]) { return false; }
+		seen[sbox[x]] = true;
+	}
+
+	complementSbox = true;
+	for (int x = 0; x < SBOX_SIZE; x++) {
+		sBox[x] = sbox[x];
+		sBoxInverse[sbox[x]] = (unsigned char) x;
+		if (sbox[x] != (unsigned char) ~x) { complementSbox = false; }
+	}
+
+	// The compiled key only describes the complement S-box
+	if (!complementSbox) { compiled = false; }
+	update_ttables(true);
+	generate_anf();
+	return true;
+}
 
 /* Permutation pi_P(): "Mixing up" the positions of the characters in input.
  * Pre: a block of input characters of length BLOCK_LEN
@@ -91,6 +235,7 @@ void SPN::pi_S(const unsigned char* input, unsigned char substituted[]) {
  *
  */
 void SPN::pi_P(const unsigned char* input, unsigned char permuted[], bool encrypt) {
+	SPN_STAT_TIME(permCycles);
 	// Do the permutation as a matrix-vector multiplication 
 	int sum;
 	for (int i = 0; i < BLOCK_LEN; i++) {
@@ -112,6 +257,7 @@ void SPN::pi_P(const unsigned char* input, unsigned char permuted[], bool encryp
 // XOR operation
 void SPN::operation_XOR(const unsigned char* input, unsigned char XORed[],
 						int numSubkey) {
+	SPN_STAT_TIME(xorCycles);
 	for (int i = 0; i < BLOCK_LEN; i++) {
 		XORed[i] = input[i] ^ subkeys[numSubkey][i];
 	}
@@ -120,53 +266,119 @@ void SPN::operation_XOR(const unsigned char* input, unsigned char XORed[],
 /***************************************************
  * ENCRYPTION
  ***************************************************
- * Encrypt a string plaintext
+ * Encrypt a string plaintext. The last block is padded with 0's if needed.
  */
 unsigned char* SPN::encrypt_ECB_mode(const unsigned char plaintext[], int len){
-	int currIndex = 0;
-
-	// Prepare input string
-	int numSubInput = (int) (len / BLOCK_LEN); 
+	SPN_STAT_ADD(bytes, len);
+	int numFullInput = (int) (len / BLOCK_LEN);
+	int numSubInput = numFullInput;
 	if (len % BLOCK_LEN != 0) { numSubInput++; }
-//	unsigned char input[numSubInput][BLOCK_LEN]; // somehow this doesn't work in testing image. possibly because the image is too big
-	unsigned char **input;
-	input = new unsigned char*[numSubInput];
-	for (int i = 0; i < numSubInput; i++) {
-		input[i] = new unsigned char[BLOCK_LEN];
+	unsigned char* ciphertext = new unsigned char[numSubInput * BLOCK_LEN];
+	SPN_STAT_ADD(allocations, 1);
+
+	// Full blocks are encrypted straight from the caller's buffer
+	encrypt_bulk(plaintext, ciphertext, numFullInput);
+
+	// Only the last partial block is copied out and padded
+	if (numSubInput != numFullInput) {
+		unsigned char last[1][BLOCK_LEN];
+		prepare_string_ECB_mode(plaintext + numFullInput * BLOCK_LEN, last,
+								len % BLOCK_LEN);
+		encrypt_bulk(last[0], ciphertext + numFullInput * BLOCK_LEN, 1);
 	}
 
-	prepare_string_ECB_mode(plaintext, input, len);
-	unsigned char* ciphertext = new unsigned char[numSubInput * BLOCK_LEN];
-	
-	for (int s = 0; s < numSubInput; s++) {
-		unsigned char* tmp = SPN_encrypt(input[s]);
-		
-		// Convert the result back to type string and copy to ciphertext string
-		for (int i = 0; i < BLOCK_LEN; i++) {
-			ciphertext[currIndex] =  tmp[i];
-			currIndex++;
-		}
+	return ciphertext;
+}
+
+// PKCS#7: full blocks straight from the caller's buffer, then the tail and
+// its padding in one stack block (a whole block of padding if len is aligned)
+unsigned char* SPN::encrypt_ECB_mode(const unsigned char plaintext[], int len, int& outLen) {
+	SPN_STAT_ADD(bytes, len);
+	int numFullInput = len / BLOCK_LEN;
+	int tail = len % BLOCK_LEN;
+	outLen = (numFullInput + 1) * BLOCK_LEN;
+	unsigned char* ciphertext = new unsigned char[outLen];
+	SPN_STAT_ADD(allocations, 1);
+
+	encrypt_bulk(plaintext, ciphertext, numFullInput);
+
+	unsigned char last[BLOCK_LEN];
+	memcpy(last, plaintext + numFullInput * BLOCK_LEN, tail);
+	memset(last + tail, BLOCK_LEN - tail, BLOCK_LEN - tail);
+	encrypt_bulk(last, ciphertext + numFullInput * BLOCK_LEN, 1);
 
-		delete [] tmp;
+	return ciphertext;
+}
+
+// Encrypt nblocks contiguous blocks without touching the heap
+void SPN::encrypt_blocks(const unsigned char in[], unsigned char out[], size_t nblocks) {
+	SPN_STAT_ADD(bytes, nblocks * BLOCK_LEN);
+	encrypt_bulk(in, out, nblocks);
+}
+
+void SPN::encrypt_bulk(const unsigned char in[], unsigned char out[], size_t nblocks) {
+	if (use_pool(nblocks * BLOCK_LEN)) {
+		pool->parallel_for(nblocks, SPN_CHUNK_BYTES / BLOCK_LEN,
+			[&](size_t begin, size_t end) {
+				encrypt_range(in + begin * BLOCK_LEN, out + begin * BLOCK_LEN, end - begin);
+			});
+	}
+	else {
+		encrypt_range(in, out, nblocks);
+	}
+}
+
+void SPN::encrypt_range(const unsigned char in[], unsigned char out[], size_t nblocks) {
+	SPN_STAT_ADD(blocks, nblocks);
+	SPN_STAT_TIME(kernelCycles);
+
+	if (tracer != NULL) {
+		SPN_HookTrace trace(tracer);
+		for (size_t s = 0; s < nblocks; s++) {
+			SPN_encrypt(in + s * BLOCK_LEN, out + s * BLOCK_LEN, trace);
+		}
+		return;
 	}
 
-	for (int i = 0; i < numSubInput; i++) {
-		delete [] input[i];
+	if (kernel == SPN_KERNEL_BITSLICE) {
+		SPN_encrypt_bitslice(in, out, nblocks);
+		return;
 	}
-	delete [] input;
 
-	return ciphertext;
+	size_t done = 0;
+	// These kernels are only valid for the complement S-box
+	if (complementSbox) {
+		if (compiled && (kernel == SPN_KERNEL_AUTO || kernel == SPN_KERNEL_COLLAPSED)) {
+			SPN_collapsed(in, out, nblocks, cPerm, cMask);
+			return;
+		}
+		if (kernel == SPN_KERNEL_AUTO || kernel == SPN_KERNEL_SIMD) {
+			done = SPN_encrypt_simd(in, out, nblocks);
+		}
+		if (fixedKernel != NULL && (kernel == SPN_KERNEL_AUTO || kernel == SPN_KERNEL_FIXED)) {
+			fixedKernel->encrypt_blocks(in + done * BLOCK_LEN, out + done * BLOCK_LEN,
+									 nblocks - done);
+			return;
+		}
+	}
+	if (kernel == SPN_KERNEL_AUTO || kernel == SPN_KERNEL_TTABLE) {
+		SPN_encrypt_ttable(in + done * BLOCK_LEN, out + done * BLOCK_LEN, nblocks - done);
+		return;
+	}
+	SPN_NoTrace trace;
+	for (size_t s = done; s < nblocks; s++) {
+		SPN_encrypt(in + s * BLOCK_LEN, out + s * BLOCK_LEN, trace);
+	}
 }
 
 // Encrypt Algorithm
-unsigned char* SPN::SPN_encrypt(const unsigned char in[BLOCK_LEN]) {
-	unsigned char* ciphertext = new unsigned char[BLOCK_LEN];
-	
-	// SPN MAIN ALGORITHM
-	unsigned char *XORed, *substituted, *permuted;
-	XORed = new unsigned char[BLOCK_LEN];
-	substituted = new unsigned char[BLOCK_LEN];
-	permuted = new unsigned char[BLOCK_LEN];
+template <class Trace>
+void SPN::SPN_encrypt(const unsigned char in[BLOCK_LEN], unsigned char out[BLOCK_LEN],
+					  Trace& trace) {
+	// SPN MAIN ALGORITHM: intermediate step's materials live on the stack
+	unsigned char XORed[BLOCK_LEN], substituted[BLOCK_LEN], permuted[BLOCK_LEN];
+
+	trace.begin_block(true);
 
 	// copy subinput input[s] to permuted as pre-round
 	for (int i = 0; i < BLOCK_LEN; i++) {
@@ -177,27 +389,26 @@ unsigned char* SPN::SPN_encrypt(const unsigned char in[BLOCK_LEN]) {
 	for (int r = 0; r < numRounds - 1; r++) {
 		// XOR result of last round with corresponding subkey of current round
 		operation_XOR(permuted, XORed, r);
+		trace.trace("XORed", r, XORed);
 
 		// Substitution Pi_S()
-		pi_S(XORed, substituted);
+		pi_S(XORed, substituted, SUBSTITUTION_ENCRYPT_MODE);
+		trace.trace("subs", r, substituted);
 			
 		// Permutation Pi_P()
 		pi_P(substituted, permuted, PERMUTATION_ENCRYPT_MODE);
+		trace.trace("perm", r, permuted);
 	}
 	// the last round does not permute the result, only XOR and pi_S()
 	operation_XOR(permuted, XORed, numRounds - 1);
-	pi_S(XORed, substituted);
+	trace.trace("XORed", numRounds - 1, XORed);
+	pi_S(XORed, substituted, SUBSTITUTION_ENCRYPT_MODE);
+	trace.trace("subs", numRounds - 1, substituted);
 
 	// Output whitening using the last subkey. Recall that we produce
 	// (numRounds + 1) subkeys. The first (numRounds) subkeys have been used.
-	operation_XOR(substituted, ciphertext, numRounds);
-
-	// destroy intermediate step's materials
-	delete [] XORed;
-	delete [] substituted;
-	delete [] permuted;
-
-	return ciphertext;
+	operation_XOR(substituted, out, numRounds);
+	trace.trace("Whitening", numRounds, out);
 }
 
 /***************************************************
@@ -206,50 +417,113 @@ unsigned char* SPN::SPN_encrypt(const unsigned char in[BLOCK_LEN]) {
  * Decrypt an array of encrypted ciphertext characters in hexa form
  */
 unsigned char* SPN::decrypt_ECB_mode(const unsigned char ciphertext[], int len) {
+	SPN_STAT_ADD(bytes, len);
 	int numSubInput = (int) len / BLOCK_LEN;
 	unsigned char* plaintext = new unsigned char[len];
+	SPN_STAT_ADD(allocations, 1);
 
-	// Prepare input ciphertext
-//	unsigned char input[numSubInput][BLOCK_LEN]; // somehow this doesn't work in testing image. possibly because the image is too big
-	unsigned char **input;
-	input = new unsigned char*[numSubInput];
-	for (int i = 0; i < numSubInput; i++) {
-		input[i] = new unsigned char[BLOCK_LEN];
+	// Decryption straight from the caller's buffer
+	decrypt_bulk(ciphertext, plaintext, numSubInput);
+
+	// A trailing partial block cannot be decrypted; pass it through unchanged
+	for (int i = numSubInput * BLOCK_LEN; i < len; i++) {
+		plaintext[i] = ciphertext[i];
 	}
 
-	prepare_string_ECB_mode(ciphertext, input, len);
-	
-	// Decryption
-	int currIndex = 0;
+	return plaintext;
+}
 
-	for (int s = 0; s < numSubInput; s++) {
-		unsigned char* tmp = SPN_decrypt(input[s]);
-		
-		// Convert the result back to type string and copy to ciphertext string
-		for (int i = 0; i < BLOCK_LEN; i++) {
-			plaintext[currIndex] =  (char) ((int) tmp[i]);
-			currIndex++;
-		}
+// PKCS#7: decrypt everything, then check and strip the padding
+unsigned char* SPN::decrypt_ECB_mode(const unsigned char ciphertext[], int len, int& outLen) {
+	SPN_STAT_ADD(bytes, len);
+	outLen = -1;
+	if (len <= 0 || len % BLOCK_LEN != 0) { return NULL; }
+	unsigned char* plaintext = new unsigned char[len];
+	SPN_STAT_ADD(allocations, 1);
+
+	decrypt_bulk(ciphertext, plaintext, len / BLOCK_LEN);
 
-		delete [] tmp;
+	int pad = plaintext[len - 1];
+	bool ok = pad >= 1 && pad <= BLOCK_LEN;
+	for (int i = len - pad; ok && i < len; i++) {
+		ok = plaintext[i] == pad;
 	}
+	if (!ok) {
+		delete [] plaintext;
+		return NULL;
+	}
+	outLen = len - pad;
+	return plaintext;
+}
 
-	for (int i = 0; i < numSubInput; i++) {
-		delete [] input[i];
+// Decrypt nblocks contiguous blocks without touching the heap
+void SPN::decrypt_blocks(const unsigned char in[], unsigned char out[], size_t nblocks) {
+	SPN_STAT_ADD(bytes, nblocks * BLOCK_LEN);
+	decrypt_bulk(in, out, nblocks);
+}
+
+void SPN::decrypt_bulk(const unsigned char in[], unsigned char out[], size_t nblocks) {
+	if (use_pool(nblocks * BLOCK_LEN)) {
+		pool->parallel_for(nblocks, SPN_CHUNK_BYTES / BLOCK_LEN,
+			[&](size_t begin, size_t end) {
+				decrypt_range(in + begin * BLOCK_LEN, out + begin * BLOCK_LEN, end - begin);
+			});
 	}
-	delete [] input;
+	else {
+		decrypt_range(in, out, nblocks);
+	}
+}
 
-	return plaintext;
+void SPN::decrypt_range(const unsigned char in[], unsigned char out[], size_t nblocks) {
+	SPN_STAT_ADD(blocks, nblocks);
+	SPN_STAT_TIME(kernelCycles);
+
+	if (tracer != NULL) {
+		SPN_HookTrace trace(tracer);
+		for (size_t s = 0; s < nblocks; s++) {
+			SPN_decrypt(in + s * BLOCK_LEN, out + s * BLOCK_LEN, trace);
+		}
+		return;
+	}
+
+	if (kernel == SPN_KERNEL_BITSLICE) {
+		SPN_decrypt_bitslice(in, out, nblocks);
+		return;
+	}
+
+	size_t done = 0;
+	// These kernels are only valid for the complement S-box
+	if (complementSbox) {
+		if (compiled && (kernel == SPN_KERNEL_AUTO || kernel == SPN_KERNEL_COLLAPSED)) {
+			SPN_collapsed(in, out, nblocks, cPermInverse, cMaskInverse);
+			return;
+		}
+		if (kernel == SPN_KERNEL_AUTO || kernel == SPN_KERNEL_SIMD) {
+			done = SPN_decrypt_simd(in, out, nblocks);
+		}
+		if (fixedKernel != NULL && (kernel == SPN_KERNEL_AUTO || kernel == SPN_KERNEL_FIXED)) {
+			fixedKernel->decrypt_blocks(in + done * BLOCK_LEN, out + done * BLOCK_LEN,
+									 nblocks - done);
+			return;
+		}
+	}
+	if (kernel == SPN_KERNEL_AUTO || kernel == SPN_KERNEL_TTABLE) {
+		SPN_decrypt_ttable(in + done * BLOCK_LEN, out + done * BLOCK_LEN, nblocks - done);
+		return;
+	}
+	SPN_NoTrace trace;
+	for (size_t s = done; s < nblocks; s++) {
+		SPN_decrypt(in + s * BLOCK_LEN, out + s * BLOCK_LEN, trace);
+	}
 }
 
 // Decryption Algorithm
-unsigned char* SPN::SPN_decrypt(const unsigned char in[BLOCK_LEN]) {
-	unsigned char* plaintext = new unsigned char[BLOCK_LEN];
-	
-	unsigned char *XORed, *substituted, *permuted;
-	XORed = new unsigned char[BLOCK_LEN];
-	substituted = new unsigned char[BLOCK_LEN];
-	permuted = new unsigned char[BLOCK_LEN];
+template <class Trace>
+void SPN::SPN_decrypt(const unsigned char in[BLOCK_LEN], unsigned char out[BLOCK_LEN],
+					  Trace& trace) {
+	unsigned char XORed[BLOCK_LEN], substituted[BLOCK_LEN], permuted[BLOCK_LEN];
+
+	trace.begin_block(false);
 
 	// copy subinput input[s] to permuted as pre-round
 	for (int i = 0; i < BLOCK_LEN; i++) {
@@ -258,66 +532,809 @@ unsigned char* SPN::SPN_decrypt(const unsigned char in[BLOCK_LEN]) {
 
 	// De-whitening
 	operation_XOR(permuted, XORed, numRounds);
+	trace.trace("De-Whitening", numRounds, XORed);
 
 	// Unwind the last pi_S() and XOR
-	pi_S(XORed, substituted);
+	pi_S(XORed, substituted, SUBSTITUTION_DECRYPT_MODE);
+	trace.trace("subs", numRounds - 1, substituted);
 	operation_XOR(substituted, XORed, numRounds - 1);
+	trace.trace("XORed", numRounds - 1, XORed);
 
 	// run through the decryption rounds
 	for (int r = numRounds - 2; r > -1; r--) {
-		cout << "--------------------------------------------------" << endl;
-
 		// Unwind Permutation Pi_P()
 		pi_P(XORed, permuted, PERMUTATION_DECRYPT_MODE); // bool encrypt is false
+		trace.trace("perm", r, permuted);
 
 		// Unwind Substitution Pi_S()
-		pi_S(permuted, substituted);
+		pi_S(permuted, substituted, SUBSTITUTION_DECRYPT_MODE);
+		trace.trace("subs", r, substituted);
 			
 		// Unwind XOR of last round with corresponding subkey of current round
 		operation_XOR(substituted, XORed, r);
+		trace.trace("XORed", r, XORed);
 	}
 
 	for (int i = 0; i < BLOCK_LEN; i++) {
-		plaintext[i] = XORed[i];
+		out[i] = XORed[i];
+	}
+}
+
+/***************************************************
+ * CIPHER BLOCK CHAINING (CBC) MODE
+ ***************************************************
+ * C_i = E(P_i ^ C_{i-1}) with C_{-1} = iv. Encryption has to go block by
+ * block. Decryption P_i = D(C_i) ^ C_{i-1} only reads ciphertext, so every
+ * chunk of blocks can be decrypted on its own.
+ */
+unsigned char* SPN::encrypt_CBC_mode(const unsigned char plaintext[], int len,
+									 const unsigned char iv[BLOCK_LEN]) {
+	SPN_STAT_ADD(bytes, len);
+	int numSubInput = (int) (len / BLOCK_LEN);
+	if (len % BLOCK_LEN != 0) { numSubInput++; }
+	unsigned char* ciphertext = new unsigned char[numSubInput * BLOCK_LEN];
+	SPN_STAT_ADD(allocations, 1);
+	const unsigned char* prev = iv;
+	unsigned char chained[BLOCK_LEN];
+
+	for (int s = 0; s < numSubInput; s++) {
+		// XOR with the previous ciphertext block, padding with 0's at the end
+		for (int i = 0; i < BLOCK_LEN; i++) {
+			int index = s * BLOCK_LEN + i;
+			unsigned char p = (index < len) ? plaintext[index] : (unsigned char) 0;
+			chained[i] = p ^ prev[i];
+		}
+		encrypt_range(chained, ciphertext + s * BLOCK_LEN, 1);
+		prev = ciphertext + s * BLOCK_LEN;
+	}
+
+	return ciphertext;
+}
+
+unsigned char* SPN::decrypt_CBC_mode(const unsigned char ciphertext[], int len,
+									 const unsigned char iv[BLOCK_LEN]) {
+	SPN_STAT_ADD(bytes, len);
+	size_t numSubInput = (size_t) (len / BLOCK_LEN);
+	unsigned char* plaintext = new unsigned char[len];
+	SPN_STAT_ADD(allocations, 1);
+
+	if (use_pool(numSubInput * BLOCK_LEN)) {
+		pool->parallel_for(numSubInput, SPN_CHUNK_BYTES / BLOCK_LEN,
+			[&](size_t begin, size_t end) {
+				CBC_decrypt_range(ciphertext, plaintext, begin, end, iv);
+			});
+	}
+	else {
+		CBC_decrypt_range(ciphertext, plaintext, 0, numSubInput, iv);
 	}
 
-	// destroy intermediate step's materials
-	delete [] XORed;
-	delete [] substituted;
-	delete [] permuted;
+	// A trailing partial block cannot be decrypted; pass it through unchanged
+	for (int i = (int) numSubInput * BLOCK_LEN; i < len; i++) {
+		plaintext[i] = ciphertext[i];
+	}
 
 	return plaintext;
 }
 
+void SPN::CBC_decrypt_range(const unsigned char ciphertext[], unsigned char plaintext[],
+							size_t begin, size_t end, const unsigned char iv[BLOCK_LEN]) {
+	decrypt_range(ciphertext + begin * BLOCK_LEN, plaintext + begin * BLOCK_LEN,
+				  end - begin);
+
+	for (size_t s = begin; s < end; s++) {
+		const unsigned char* prev = (s == 0) ? iv : ciphertext + (s - 1) * BLOCK_LEN;
+		for (int i = 0; i < BLOCK_LEN; i++) {
+			plaintext[s * BLOCK_LEN + i] ^= prev[i];
+		}
+	}
+}
+
+/***************************************************
+ * COUNTER (CTR) MODE
+ ***************************************************
+ * The keystream is generated SPN_CTR_BATCH blocks at a time on the stack.
+ * Large inputs are cut into SPN_CHUNK_BYTES pieces handed to the pool; each
+ * piece only needs its own byte offset to find its counter blocks.
+ */
+void SPN::encrypt_CTR_mode(const unsigned char in[], unsigned char out[], size_t len,
+						   uint32_t nonce, uint32_t counter, uint64_t offset) {
+	SPN_STAT_ADD(bytes, len);
+	if (use_pool(len)) {
+		pool->parallel_for(len, SPN_CHUNK_BYTES,
+			[&](size_t begin, size_t end) {
+				CTR_range(in + begin, out + begin, end - begin, nonce, counter,
+						  offset + begin);
+			});
+	}
+	else {
+		CTR_range(in, out, len, nonce, counter, offset);
+	}
+}
+
+// CTR decryption is the same XOR with the same keystream
+void SPN::decrypt_CTR_mode(const unsigned char in[], unsigned char out[], size_t len,
+						   uint32_t nonce, uint32_t counter, uint64_t offset) {
+	encrypt_CTR_mode(in, out, len, nonce, counter, offset);
+}
+
+void SPN::CTR_range(const unsigned char in[], unsigned char out[], size_t len,
+					uint32_t nonce, uint32_t counter, uint64_t offset) {
+	unsigned char keystream[SPN_CTR_BATCH * BLOCK_LEN];
+	uint64_t block = offset / BLOCK_LEN;
+	size_t skip = (size_t) (offset % BLOCK_LEN); // bytes of the first block before offset
+	size_t done = 0;
+
+	while (done < len) {
+		size_t numBlocks = (skip + (len - done) + BLOCK_LEN - 1) / BLOCK_LEN;
+		if (numBlocks > SPN_CTR_BATCH) { numBlocks = SPN_CTR_BATCH; }
+
+		// Counter blocks: nonce || (counter + block number)
+		for (size_t b = 0; b < numBlocks; b++) {
+			uint32_t ctr = counter + (uint32_t) (block + b);
+			unsigned char* c = keystream + b * BLOCK_LEN;
+			c[0] = (unsigned char) (nonce >> 24);
+			c[1] = (unsigned char) (nonce >> 16);
+			c[2] = (unsigned char) (nonce >> 8);
+			c[3] = (unsigned char) nonce;
+			c[4] = (unsigned char) (ctr >> 24);
+			c[5] = (unsigned char) (ctr >> 16);
+			c[6] = (unsigned char) (ctr >> 8);
+			c[7] = (unsigned char) ctr;
+		}
+		encrypt_range(keystream, keystream, numBlocks);
+
+		size_t avail = numBlocks * BLOCK_LEN - skip;
+		if (avail > len - done) { avail = len - done; }
+		for (size_t i = 0; i < avail; i++) {
+			out[done + i] = in[done + i] ^ keystream[skip + i];
+		}
+
+		done += avail;
+		block += numBlocks;
+		skip = 0;
+	}
+}
+
+/***************************************************
+ * SIMD KERNEL
+ ***************************************************
+ * Several blocks are packed into one register (2 with SSSE3, 4 with AVX2,
+ * 8 with AVX-512). Since pi_S() is the bitwise complement, XOR with subkey
+ * K_r followed by pi_S() is a single XOR with ~K_r. pi_P() only moves bytes
+ * around, so it is one pshufb with a mask built from pIndex (each block
+ * offset by 8 lanes). Encryption and decryption are then both the program
+ *
+ *   x ^= keys[0]; for r >= 1: x = shuffle(x, perm); x ^= keys[r]
+ *
+ * with the folded keys of setup_kernels(). Output is bit-identical to
+ * SPN_encrypt()/SPN_decrypt().
+ *
+ * Each instruction set gets its own copy of the kernel, compiled with a
+ * target attribute rather than -march, so one binary runs everywhere. The
+ * best copy the CPU supports is picked on first use; the SPN_ISA environment
+ * variable (scalar, ssse3, avx2 or avx512) can force a lesser one.
+ */
+typedef size_t (*SPN_ShuffleKernel)(const unsigned char in[], unsigned char out[],
+	size_t nblocks, const unsigned char perm[BLOCK_LEN], const uint64_t keys[], int numKeys);
+
+static size_t shuffle_xor_scalar(const unsigned char[], unsigned char[], size_t,
+		const unsigned char[], const uint64_t[], int) {
+	return 0; // leave every block to the portable kernels
+}
+
+#if defined(SPN_X86)
+
+// Shuffle mask that applies the gather perm[] to each 8-byte half
+static inline __m128i make_shuffle_128(const unsigned char perm[BLOCK_LEN]) {
+	unsigned char mask[2 * BLOCK_LEN];
+	for (int b = 0; b < 2; b++) {
+		for (int i = 0; i < BLOCK_LEN; i++) {
+			mask[b * BLOCK_LEN + i] = (unsigned char) (b * BLOCK_LEN + perm[i]);
+		}
+	}
+	return _mm_loadu_si128((const __m128i*) mask);
+}
+
+__attribute__((target("ssse3")))
+static size_t shuffle_xor_ssse3(const unsigned char in[], unsigned char out[], size_t nblocks,
+		const unsigned char perm[BLOCK_LEN], const uint64_t keys[], int numKeys) {
+	const __m128i shuf = make_shuffle_128(perm);
+	size_t s = 0;
+	for (; s + 2 <= nblocks; s += 2) {
+		__m128i x = _mm_loadu_si128((const __m128i*) (in + s * BLOCK_LEN));
+		x = _mm_xor_si128(x, _mm_set1_epi64x((long long) keys[0]));
+		for (int r = 1; r < numKeys; r++) {
+			x = _mm_shuffle_epi8(x, shuf);
+			x = _mm_xor_si128(x, _mm_set1_epi64x((long long) keys[r]));
+		}
+		_mm_storeu_si128((__m128i*) (out + s * BLOCK_LEN), x);
+	}
+	return s;
+}
+
+__attribute__((target("avx2")))
+static size_t shuffle_xor_avx2(const unsigned char in[], unsigned char out[], size_t nblocks,
+		const unsigned char perm[BLOCK_LEN], const uint64_t keys[], int numKeys) {
+	const __m256i shuf = _mm256_broadcastsi128_si256(make_shuffle_128(perm));
+	size_t s = 0;
+	for (; s + 4 <= nblocks; s += 4) {
+		__m256i x = _mm256_loadu_si256((const __m256i*) (in + s * BLOCK_LEN));
+		x = _mm256_xor_si256(x, _mm256_set1_epi64x((long long) keys[0]));
+		for (int r = 1; r < numKeys; r++) {
+			x = _mm256_shuffle_epi8(x, shuf);
+			x = _mm256_xor_si256(x, _mm256_set1_epi64x((long long) keys[r]));
+		}
+		_mm256_storeu_si256((__m256i*) (out + s * BLOCK_LEN), x);
+	}
+	// Leave no dirty upper halves behind for SSE code, which would stall on them
+	_mm256_zeroupper();
+	return s + shuffle_xor_ssse3(in + s * BLOCK_LEN, out + s * BLOCK_LEN, nblocks - s,
+								 perm, keys, numKeys);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t shuffle_xor_avx512(const unsigned char in[], unsigned char out[], size_t nblocks,
+		const unsigned char perm[BLOCK_LEN], const uint64_t keys[], int numKeys) {
+	const __m512i shuf = _mm512_broadcast_i32x4(make_shuffle_128(perm));
+	size_t s = 0;
+	for (; s + 8 <= nblocks; s += 8) {
+		__m512i x = _mm512_loadu_si512((const void*) (in + s * BLOCK_LEN));
+		x = _mm512_xor_si512(x, _mm512_set1_epi64((long long) keys[0]));
+		for (int r = 1; r < numKeys; r++) {
+			x = _mm512_shuffle_epi8(x, shuf);
+			x = _mm512_xor_si512(x, _mm512_set1_epi64((long long) keys[r]));
+		}
+		_mm512_storeu_si512((void*) (out + s * BLOCK_LEN), x);
+	}
+	_mm256_zeroupper();
+	return s + shuffle_xor_avx2(in + s * BLOCK_LEN, out + s * BLOCK_LEN, nblocks - s,
+								perm, keys, numKeys);
+}
+
+#endif
+
+static const char* const ISA_NAMES[] = {"scalar", "ssse3", "avx2", "avx512"};
+
+// Whether this CPU (and OS) can run the kernel for isa
+static bool cpu_supports(SPN_Isa isa) {
+#if defined(SPN_X86)
+	__builtin_cpu_init();
+	switch (isa) {
+		case SPN_ISA_SSSE3: return __builtin_cpu_supports("ssse3");
+		case SPN_ISA_AVX2: return __builtin_cpu_supports("avx2");
+		case SPN_ISA_AVX512: return __builtin_cpu_supports("avx512f")
+								 && __builtin_cpu_supports("avx512bw");
+		default: break;
+	}
+#endif
+	return isa == SPN_ISA_SCALAR;
+}
+
+// Best supported instruction set, or SPN_ISA if it names a supported one
+static SPN_Isa detect_isa() {
+	int best = SPN_ISA_AVX512;
+	while (!cpu_supports((SPN_Isa) best)) { best--; }
+
+	const char* env = getenv("SPN_ISA");
+	for (int i = 0; env != NULL && i <= best; i++) {
+		if (strcmp(env, ISA_NAMES[i]) == 0) { return (SPN_Isa) i; }
+	}
+	return (SPN_Isa) best;
+}
+
+// Process-wide selection, detected on first use
+static SPN_Isa& active_isa() {
+	static SPN_Isa isa = detect_isa();
+	return isa;
+}
+
+static SPN_ShuffleKernel shuffle_kernel() {
+#if defined(SPN_X86)
+	switch (active_isa()) {
+		case SPN_ISA_SSSE3: return shuffle_xor_ssse3;
+		case SPN_ISA_AVX2: return shuffle_xor_avx2;
+		case SPN_ISA_AVX512: return shuffle_xor_avx512;
+		default: break;
+	}
+#endif
+	return shuffle_xor_scalar;
+}
+
+SPN_Isa SPN::get_isa() {
+	return active_isa();
+}
+
+bool SPN::set_isa(SPN_Isa isa) {
+	if (isa < SPN_ISA_SCALAR || isa > SPN_ISA_AVX512 || !cpu_supports(isa)) { return false; }
+	active_isa() = isa;
+	return true;
+}
+
+const char* SPN::isa_name(SPN_Isa isa) {
+	if (isa < SPN_ISA_SCALAR || isa > SPN_ISA_AVX512) { return "unknown"; }
+	return ISA_NAMES[isa];
+}
+
+size_t SPN::SPN_encrypt_simd(const unsigned char in[], unsigned char out[], size_t nblocks) {
+	return shuffle_kernel()(in, out, nblocks, pIndex, shuffleKeys, numRounds);
+}
+
+size_t SPN::SPN_decrypt_simd(const unsigned char in[], unsigned char out[], size_t nblocks) {
+	return shuffle_kernel()(in, out, nblocks, pIndexInverse, shuffleKeysInverse, numRounds);
+}
+
+/***************************************************
+ * T-TABLE KERNEL
+ ***************************************************
+ * Like the AES T-tables: a round of encryption sends byte j of (x ^ K_r)
+ * through pi_S() and then to position i of the output, where pIndex[i] = j.
+ * tTable[j][b] is sBox[b] already shifted to byte i of a 64-bit word, so the
+ * round is BLOCK_LEN lookups XORed together. tTableInverse does the same for
+ * the inverse of pi_P() followed by the inverse of pi_S(). Blocks are read as
+ * little-endian words: byte i of a block is bits 8i..8i+7.
+ */
+static inline uint64_t load_block_64(const unsigned char* b) {
+	uint64_t x = 0;
+	for (int i = BLOCK_LEN - 1; i >= 0; i--) { x = (x << 8) | b[i]; }
+	return x;
+}
+
+static inline void store_block_64(unsigned char* b, uint64_t x) {
+	for (int i = 0; i < BLOCK_LEN; i++) { b[i] = (unsigned char) (x >> (8 * i)); }
+}
+
+/*
+ * The tables are the bulk of an SPN object, and most objects never use them:
+ * with the complement S-box the fixed kernel (4, 8, 16 rounds) or a compiled
+ * key takes every block. They exist only while encrypt_range() can reach
+ * the T-table kernel.
+ */
+void SPN::update_ttables(bool rebuild) {
+	bool needed = kernel == SPN_KERNEL_TTABLE
+		|| (kernel == SPN_KERNEL_AUTO && (!complementSbox || (!compiled && fixedKernel == NULL)));
+	if (tTable != NULL && (!needed || rebuild)) {
+		delete [] tTable;
+		delete [] tTableInverse;
+		tTable = NULL;
+		tTableInverse = NULL;
+	}
+	if (!needed || tTable != NULL) { return; }
+
+	tTable = new uint64_t[BLOCK_LEN][SBOX_SIZE];
+	tTableInverse = new uint64_t[BLOCK_LEN][SBOX_SIZE];
+	for (int j = 0; j < BLOCK_LEN; j++) {
+		for (int b = 0; b < SBOX_SIZE; b++) {
+			tTable[j][b] = (uint64_t) sBox[b] << (8 * pIndexInverse[j]);
+			tTableInverse[j][b] = (uint64_t) sBoxInverse[b] << (8 * pIndex[j]);
+		}
+	}
+}
+
+void SPN::SPN_encrypt_ttable(const unsigned char in[], unsigned char out[], size_t nblocks) {
+	for (size_t s = 0; s < nblocks; s++) {
+		uint64_t x = load_block_64(in + s * BLOCK_LEN);
+		for (int r = 0; r < numRounds - 1; r++) {
+			x ^= load_block_64(subkeys[r]);
+			uint64_t y = 0;
+			for (int j = 0; j < BLOCK_LEN; j++) {
+				y ^= tTable[j][(x >> (8 * j)) & 0xff];
+			}
+			x = y;
+		}
+		// the last round does not permute: plain S-box, then whitening
+		x ^= load_block_64(subkeys[numRounds - 1]);
+		uint64_t y = 0;
+		for (int j = 0; j < BLOCK_LEN; j++) {
+			y |= (uint64_t) sBox[(x >> (8 * j)) & 0xff] << (8 * j);
+		}
+		x = y ^ load_block_64(subkeys[numRounds]);
+		store_block_64(out + s * BLOCK_LEN, x);
+	}
+}
+
+void SPN::SPN_decrypt_ttable(const unsigned char in[], unsigned char out[], size_t nblocks) {
+	for (size_t s = 0; s < nblocks; s++) {
+		uint64_t x = load_block_64(in + s * BLOCK_LEN) ^ load_block_64(subkeys[numRounds]);
+		uint64_t y = 0;
+		for (int j = 0; j < BLOCK_LEN; j++) {
+			y |= (uint64_t) sBoxInverse[(x >> (8 * j)) & 0xff] << (8 * j);
+		}
+		x = y ^ load_block_64(subkeys[numRounds - 1]);
+		for (int r = numRounds - 2; r > -1; r--) {
+			y = 0;
+			for (int j = 0; j < BLOCK_LEN; j++) {
+				y ^= tTableInverse[j][(x >> (8 * j)) & 0xff];
+			}
+			x = y ^ load_block_64(subkeys[r]);
+		}
+		store_block_64(out + s * BLOCK_LEN, x);
+	}
+}
+
+/***************************************************
+ * BITSLICED KERNEL
+ ***************************************************
+ * 64 blocks are transposed so that word p holds bit p of every block (bit s
+ * of the word belongs to block s). In that form a round touches 64 blocks at
+ * once: XOR with subkey K_r sends every plane through ~0 or 0 depending on bit
+ * p of K_r, and pi_S() of byte i is a Boolean function of the 8 planes of
+ * that byte, evaluated with ANDs and XORs on whole words. pi_P() only moves
+ * whole bytes, i.e. groups of 8 planes, so it is done by renaming: at[i] is
+ * the group currently holding byte i of the block, and no plane is moved
+ * until the final transpose.
+ *
+ * pi_S() is evaluated from its algebraic normal form: output bit j is the XOR
+ * of the monomials (ANDs of input bits) whose coefficient is set. All 256
+ * monomials of a byte take 255 ANDs; each output bit then XORs in its own.
+ * No memory access depends on the data, so unlike the T-table kernel this
+ * one leaks nothing through the cache, at a few times the cost. The
+ * complement S-box needs no circuit at all: it is folded into the key XOR.
+ */
+#define BITSLICE_BLOCKS 64 // blocks per batch, one per bit of a plane
+
+// Coefficients of output bit j of sbox: bit m of anf[j] is set if the
+// monomial of the input bits in m appears (Moebius transform of the truth
+// table)
+static void sbox_anf(const unsigned char sbox[SBOX_SIZE], uint64_t anf[8][SBOX_SIZE / 64]) {
+	for (int j = 0; j < 8; j++) {
+		unsigned char t[SBOX_SIZE];
+		for (int x = 0; x < SBOX_SIZE; x++) { t[x] = (sbox[x] >> j) & 1; }
+		for (int b = 1; b < SBOX_SIZE; b <<= 1) {
+			for (int x = 0; x < SBOX_SIZE; x++) {
+				if (x & b) { t[x] ^= t[x ^ b]; }
+			}
+		}
+		memset(anf[j], 0, sizeof(anf[j]));
+		for (int m = 0; m < SBOX_SIZE; m++) {
+			anf[j][m / 64] |= (uint64_t) t[m] << (m % 64);
+		}
+	}
+}
+
+void SPN::generate_anf() {
+	sbox_anf(sBox, sBoxAnf);
+	sbox_anf(sBoxInverse, sBoxInverseAnf);
+}
+
+// In-place transpose of a 64x64 bit matrix: bit j of a[i] trades places
+// with bit i of a[j]. Six rounds of swapping ever smaller sub-blocks.
+static void transpose_64(uint64_t a[64]) {
+	uint64_t m = 0x00000000FFFFFFFFULL;
+	for (int j = 32; j != 0; j >>= 1, m ^= m << j) {
+		for (int k = 0; k < 64; k = (k + j + 1) & ~j) {
+			uint64_t t = ((a[k] >> j) ^ a[k + j]) & m;
+			a[k + j] ^= t;
+			a[k] ^= t << j;
+		}
+	}
+}
+
+// Up to BITSLICE_BLOCKS blocks into bit planes; missing blocks are zero
+static void bitslice_load(const unsigned char* in, size_t n, uint64_t x[64]) {
+	for (size_t s = 0; s < BITSLICE_BLOCKS; s++) {
+		x[s] = s < n ? load_block_64(in + s * BLOCK_LEN) : 0;
+	}
+	transpose_64(x);
+}
+
+// Gather the planes of byte i from group at[i] and write back n blocks
+static void bitslice_store(const uint64_t x[64], const unsigned char at[BLOCK_LEN],
+						   unsigned char* out, size_t n) {
+	uint64_t y[64];
+	for (int i = 0; i < BLOCK_LEN; i++) {
+		for (int b = 0; b < 8; b++) { y[8 * i + b] = x[8 * at[i] + b]; }
+	}
+	transpose_64(y);
+	for (size_t s = 0; s < n; s++) { store_block_64(out + s * BLOCK_LEN, y[s]); }
+}
+
+// XOR the constant k into every block: plane p of byte i is flipped iff bit
+// 8i + p of k is set
+static inline void bitslice_xor(uint64_t x[64], const unsigned char at[BLOCK_LEN], uint64_t k) {
+	for (int i = 0; i < BLOCK_LEN; i++) {
+		for (int b = 0; b < 8; b++) {
+			x[8 * at[i] + b] ^= 0 - ((k >> (8 * i + b)) & 1);
+		}
+	}
+}
+
+// The S-box with coefficients anf on every byte: planes p[0..8) of a group
+static void bitslice_sbox(uint64_t p[8], const uint64_t anf[8][SBOX_SIZE / 64]) {
+	uint64_t mono[SBOX_SIZE];
+	mono[0] = ~0ULL;
+	for (int b = 0; b < 8; b++) {
+		for (int m = 1 << b; m < 2 << b; m++) { mono[m] = mono[m ^ (1 << b)] & p[b]; }
+	}
+	for (int j = 0; j < 8; j++) {
+		uint64_t y = 0;
+		for (int w = 0; w < SBOX_SIZE / 64; w++) {
+			for (uint64_t c = anf[j][w]; c != 0; c &= c - 1) {
+				y ^= mono[64 * w + __builtin_ctzll(c)];
+			}
+		}
+		p[j] = y;
+	}
+}
+
+// Key XOR and pi_S() of one round; the complement S-box is part of the XOR
+static inline void bitslice_round(uint64_t x[64], const unsigned char at[BLOCK_LEN],
+								  uint64_t k, bool complement,
+								  const uint64_t anf[8][SBOX_SIZE / 64]) {
+	if (complement) {
+		bitslice_xor(x, at, ~k);
+		return;
+	}
+	bitslice_xor(x, at, k);
+	for (int g = 0; g < BLOCK_LEN; g++) { bitslice_sbox(x + 8 * g, anf); }
+}
+
+void SPN::SPN_encrypt_bitslice(const unsigned char in[], unsigned char out[], size_t nblocks) {
+	uint64_t x[64];
+	unsigned char at[BLOCK_LEN], tmp[BLOCK_LEN];
+	for (size_t s = 0; s < nblocks; s += BITSLICE_BLOCKS) {
+		size_t n = min((size_t) BITSLICE_BLOCKS, nblocks - s);
+		bitslice_load(in + s * BLOCK_LEN, n, x);
+		for (int i = 0; i < BLOCK_LEN; i++) { at[i] = (unsigned char) i; }
+
+		for (int r = 0; r < numRounds - 1; r++) {
+			bitslice_round(x, at, load_block_64(subkeys[r]), complementSbox, sBoxAnf);
+			for (int i = 0; i < BLOCK_LEN; i++) { tmp[i] = at[pIndex[i]]; }
+			memcpy(at, tmp, BLOCK_LEN);
+		}
+		// Last round (XOR, pi_S()) and output whitening
+		bitslice_round(x, at, load_block_64(subkeys[numRounds - 1]), complementSbox, sBoxAnf);
+		bitslice_xor(x, at, load_block_64(subkeys[numRounds]));
+		bitslice_store(x, at, out + s * BLOCK_LEN, n);
+	}
+}
+
+/*
+ * ~x ^ k == ~(x ^ k), so with the complement S-box "undo pi_S(), then XOR"
+ * is the same one XOR as in encryption. Any other S-box runs its inverse
+ * circuit and then the XOR.
+ */
+void SPN::SPN_decrypt_bitslice(const unsigned char in[], unsigned char out[], size_t nblocks) {
+	uint64_t x[64];
+	unsigned char at[BLOCK_LEN], tmp[BLOCK_LEN];
+	for (size_t s = 0; s < nblocks; s += BITSLICE_BLOCKS) {
+		size_t n = min((size_t) BITSLICE_BLOCKS, nblocks - s);
+		bitslice_load(in + s * BLOCK_LEN, n, x);
+		for (int i = 0; i < BLOCK_LEN; i++) { at[i] = (unsigned char) i; }
+
+		bitslice_xor(x, at, load_block_64(subkeys[numRounds]));
+		for (int r = numRounds - 1; r > -1; r--) {
+			if (r < numRounds - 1) {
+				for (int i = 0; i < BLOCK_LEN; i++) { tmp[i] = at[pIndexInverse[i]]; }
+				memcpy(at, tmp, BLOCK_LEN);
+			}
+			if (complementSbox) {
+				bitslice_xor(x, at, ~load_block_64(subkeys[r]));
+				continue;
+			}
+			for (int g = 0; g < BLOCK_LEN; g++) { bitslice_sbox(x + 8 * g, sBoxInverseAnf); }
+			bitslice_xor(x, at, load_block_64(subkeys[r]));
+		}
+		bitslice_store(x, at, out + s * BLOCK_LEN, n);
+	}
+}
+
+/***************************************************
+ * COMPILED KEY
+ ***************************************************
+ * pi_S() is the bitwise complement and pi_P() only moves bytes, so the whole
+ * cipher is affine: ciphertext[i] = plaintext[cPerm[i]] ^ cMask[i]. We find
+ * cPerm and cMask by tracking, for every output byte, which input byte it
+ * came from and what has been XORed into it so far.
+ */
+void SPN::compile_key() {
+	if (!complementSbox) { return; }
+
+	unsigned char src[BLOCK_LEN], mask[BLOCK_LEN];
+	unsigned char tmpSrc[BLOCK_LEN], tmpMask[BLOCK_LEN];
+
+	for (int i = 0; i < BLOCK_LEN; i++) {
+		src[i] = (unsigned char) i;
+		mask[i] = 0;
+	}
+
+	for (int r = 0; r < numRounds - 1; r++) {
+		// XOR with subkey, then pi_S() complements every byte
+		for (int i = 0; i < BLOCK_LEN; i++) {
+			mask[i] ^= (unsigned char) ~subkeys[r][i];
+		}
+		// pi_P() moves the (source, mask) pairs together
+		for (int i = 0; i < BLOCK_LEN; i++) {
+			tmpSrc[i] = src[pIndex[i]];
+			tmpMask[i] = mask[pIndex[i]];
+		}
+		memcpy(src, tmpSrc, BLOCK_LEN);
+		memcpy(mask, tmpMask, BLOCK_LEN);
+	}
+	// Last round (XOR, pi_S()) and output whitening
+	for (int i = 0; i < BLOCK_LEN; i++) {
+		mask[i] ^= (unsigned char) ~subkeys[numRounds - 1][i];
+		mask[i] ^= subkeys[numRounds][i];
+	}
+
+	// Decryption undoes it: plaintext[src[i]] = ciphertext[i] ^ mask[i]
+	for (int i = 0; i < BLOCK_LEN; i++) {
+		cPerm[i] = src[i];
+		cMask[i] = mask[i];
+		cPermInverse[src[i]] = (unsigned char) i;
+		cMaskInverse[src[i]] = mask[i];
+	}
+	compiled = true;
+	update_ttables();
+}
+
+// Compiled (collapsed) kernel: one gather and one XOR per block
+void SPN::SPN_collapsed(const unsigned char in[], unsigned char out[], size_t nblocks,
+		const unsigned char perm[BLOCK_LEN], const unsigned char mask[BLOCK_LEN]) {
+	// The same shuffle kernel with no key before the gather and mask after it
+	uint64_t keys[2] = {0, 0};
+	memcpy(&keys[1], mask, BLOCK_LEN);
+	size_t s = shuffle_kernel()(in, out, nblocks, perm, keys, 2);
+	unsigned char tmp[BLOCK_LEN];
+	for (; s < nblocks; s++) {
+		const unsigned char* b = in + s * BLOCK_LEN;
+		for (int i = 0; i < BLOCK_LEN; i++) {
+			tmp[i] = b[perm[i]] ^ mask[i];
+		}
+		memcpy(out + s * BLOCK_LEN, tmp, BLOCK_LEN);
+	}
+}
+
+// Parallel mode: run bulk blocks on a persistent pool of n threads
+void SPN::set_num_threads(int n) {
+	if (n == 0) {
+		n = (int) thread::hardware_concurrency();
+	}
+	set_pool(NULL);
+	if (n > 1) {
+		pool = new SPN_ThreadPool(n);
+		ownsPool = true;
+	}
+}
+
+// Parallel mode on a pool owned by the caller
+void SPN::set_pool(SPN_ThreadPool* shared) {
+	if (ownsPool) { delete pool; }
+	pool = shared;
+	ownsPool = false;
+}
+
+// Inputs smaller than this many bytes are processed on the calling thread
+void SPN::set_parallel_threshold(size_t bytes) {
+	parallelThreshold = bytes;
+}
+
+// Run body over [0, count) on the pool, or on the calling thread
+void SPN::parallel_for(size_t count, size_t chunkSize,
+					   const function<void(size_t, size_t)>& body) {
+	if (pool != NULL && tracer == NULL) {
+		pool->parallel_for(count, chunkSize, body);
+	}
+	else {
+		body(0, count);
+	}
+}
+
+// Whether a call on this many bytes should be spread over the pool. Tracers
+// expect blocks in order, so tracing keeps everything on the calling thread.
+bool SPN::use_pool(size_t bytes) const {
+	return pool != NULL && tracer == NULL && bytes >= parallelThreshold;
+}
+
+// Report every intermediate value to tracer (NULL turns tracing off)
+void SPN::set_tracer(SPN_Tracer* t) {
+	tracer = t;
+}
+
+/***************************************************
+ * INSTRUMENTATION
+ ***************************************************/
+SPN_Stats SPN::stats_snapshot() const {
+	SPN_Stats snap;
+#ifdef SPN_STATS
+	snap.blocks = stats.blocks;
+	snap.bytes = stats.bytes;
+	snap.allocations = stats.allocations;
+	snap.prepareCycles = stats.prepareCycles;
+	snap.xorCycles = stats.xorCycles;
+	snap.subsCycles = stats.subsCycles;
+	snap.permCycles = stats.permCycles;
+	snap.kernelCycles = stats.kernelCycles;
+#else
+	memset(&snap, 0, sizeof(snap));
+#endif
+	return snap;
+}
+
+string SPN::stats_json() const {
+	SPN_Stats snap = stats_snapshot();
+	ostringstream json;
+	json << "{\"enabled\": "
+#ifdef SPN_STATS
+		 << "true"
+#else
+		 << "false"
+#endif
+		 << ", \"blocks\": " << snap.blocks
+		 << ", \"bytes\": " << snap.bytes
+		 << ", \"allocations\": " << snap.allocations
+		 << ", \"prepare_cycles\": " << snap.prepareCycles
+		 << ", \"xor_cycles\": " << snap.xorCycles
+		 << ", \"subs_cycles\": " << snap.subsCycles
+		 << ", \"perm_cycles\": " << snap.permCycles
+		 << ", \"kernel_cycles\": " << snap.kernelCycles << "}";
+	return json.str();
+}
+
+void SPN::reset_stats() {
+#ifdef SPN_STATS
+	stats.blocks = 0;
+	stats.bytes = 0;
+	stats.allocations = 0;
+	stats.prepareCycles = 0;
+	stats.xorCycles = 0;
+	stats.subsCycles = 0;
+	stats.permCycles = 0;
+	stats.kernelCycles = 0;
+#endif
+}
+
+// Select the kernel used by encrypt_blocks()/decrypt_blocks()
+void SPN::set_kernel(SPN_Kernel k) {
+	kernel = k;
+	update_ttables();
+}
+
 
 //**************************************************
 // Permutation matrix generator for pi_P()
 //**************************************************
-void SPN::generate_permutation_matrix() {
-	srand(time(NULL));
-	int row = rand() % BLOCK_LEN;
+void SPN::generate_permutation_matrix(unsigned int seed) {
+	// Own generator (the classic ANSI C rand()) so the same seed gives the
+	// same permutation on every platform and no global state is touched
+	unsigned int state = seed;
+	int row = 0;
 	bool flag[BLOCK_LEN] = {false}; // flag to know what columns already have a 1
+	unsigned char perm[BLOCK_LEN];
 
+	// the <row>th entry of each column is set to 1
+	// such that it's the only 1 on that row
+	for (int i = 0; i < BLOCK_LEN; i++) {
+		do {
+			state = state * 1103515245 + 12345;
+			row = (int) ((state >> 16) & 0x7fff) % BLOCK_LEN;
+		// if there's already a 1 on the current row, keep drawing
+		} while (flag[row] == true);
+		flag[row] = true;
+		perm[row] = (unsigned char) i;
+	}
+
+	set_permutation(perm);
+}
+
+// Fill pMatrix, pMatrixInverse and the gather indices from perm
+void SPN::set_permutation(const unsigned char perm[BLOCK_LEN]) {
 	for (int i = 0; i < BLOCK_LEN; i++) {
 		for (int j = 0; j < BLOCK_LEN; j++) {
 			pMatrix[i][j] = 0;
 			pMatrixInverse[i][j] = 0;
 		}
 	}
-	
-	// the <row>th entry of each column is set to 1
-	// such that it's the only 1 on that row
-	for (int i = 0; i < BLOCK_LEN; i++) {
-		row = rand() % BLOCK_LEN;
-		// if there's already a 1 on the current row, keep running rand()
-		while (flag[row] == true) { 
-			row = rand() % BLOCK_LEN;
-		}
-		flag[row] = true;
+
+	for (int row = 0; row < BLOCK_LEN; row++) {
+		int i = perm[row];
 		pMatrix[row][i] = 1;
 		pMatrixInverse[i][row] = 1; // transpose(pMatrix) = inverse(pMatrix)
+		pIndex[row] = (unsigned char) i; // same permutation as gather indices
+		pIndexInverse[i] = (unsigned char) row;
 	}
 
+	if (!verbose) { return; }
+
 	cout << "Permutation Matrix (for Encryption): " << endl;
 	for (int i = 0; i < BLOCK_LEN; i++) {
 		for (int j = 0; j < BLOCK_LEN; j++) {
@@ -336,43 +1353,202 @@ void SPN::generate_permutation_matrix() {
 	}
 }
 
+/***************************************************
+ * EXPANDED KEY SCHEDULE EXPORT
+ ***************************************************
+ * Blob layout (byte offsets):
+ *   0  "SPNK"
+ *   4  SPN_SCHEDULE_VERSION
+ *   5  flags: bit 0 = compiled key present, bit 1 = default S-box
+ *   6  numRounds, 16-bit little-endian
+ *   8  key (KEY_LEN)
+ *      subkeys ((numRounds + 1) * BLOCK_LEN)
+ *      pIndex (BLOCK_LEN)
+ *      sBox (SBOX_SIZE), only without the default S-box flag
+ *      cPerm, cMask, cPermInverse, cMaskInverse (4 * BLOCK_LEN), if compiled
+ */
+#define SCHEDULE_FLAG_COMPILED 1
+#define SCHEDULE_FLAG_DEFAULT_SBOX 2
+#define SCHEDULE_HEADER_LEN 8
+
+// Size of a blob for the given round count and flags
+static size_t schedule_blob_size(int nr, int flags) {
+	size_t size = SCHEDULE_HEADER_LEN + KEY_LEN + (nr + 1) * BLOCK_LEN + BLOCK_LEN;
+	if (!(flags & SCHEDULE_FLAG_DEFAULT_SBOX)) { size += SBOX_SIZE; }
+	if (flags & SCHEDULE_FLAG_COMPILED) { size += 4 * BLOCK_LEN; }
+	return size;
+}
+
+size_t SPN::schedule_size() const {
+	int flags = (compiled ? SCHEDULE_FLAG_COMPILED : 0)
+		| (complementSbox ? SCHEDULE_FLAG_DEFAULT_SBOX : 0);
+	return schedule_blob_size(numRounds, flags);
+}
+
+void SPN::export_schedule(unsigned char blob[]) const {
+	int flags = (compiled ? SCHEDULE_FLAG_COMPILED : 0)
+		| (complementSbox ? SCHEDULE_FLAG_DEFAULT_SBOX : 0);
+	unsigned char* p = blob;
+
+	memcpy(p, "SPNK", 4);
+	p[4] = SPN_SCHEDULE_VERSION;
+	p[5] = (unsigned char) flags;
+	p[6] = (unsigned char) (numRounds & 0xff);
+	p[7] = (unsigned char) (numRounds >> 8);
+	p += SCHEDULE_HEADER_LEN;
+
+	memcpy(p, key, KEY_LEN);
+	p += KEY_LEN;
+	for (int r = 0; r < numRounds + 1; r++) {
+		memcpy(p, subkeys[r], BLOCK_LEN);
+		p += BLOCK_LEN;
+	}
+	memcpy(p, pIndex, BLOCK_LEN);
+	p += BLOCK_LEN;
+	if (!complementSbox) {
+		memcpy(p, sBox, SBOX_SIZE);
+		p += SBOX_SIZE;
+	}
+	if (compiled) {
+		memcpy(p, cPerm, BLOCK_LEN);
+		memcpy(p + BLOCK_LEN, cMask, BLOCK_LEN);
+		memcpy(p + 2 * BLOCK_LEN, cPermInverse, BLOCK_LEN);
+		memcpy(p + 3 * BLOCK_LEN, cMaskInverse, BLOCK_LEN);
+	}
+}
+
+SPN* SPN::import_schedule(const unsigned char blob[], size_t len) {
+	if (len < SCHEDULE_HEADER_LEN || memcmp(blob, "SPNK", 4) != 0
+		|| blob[4] != SPN_SCHEDULE_VERSION) {
+		return NULL;
+	}
+	int flags = blob[5];
+	int nr = blob[6] | (blob[7] << 8);
+	if ((flags & ~(SCHEDULE_FLAG_COMPILED | SCHEDULE_FLAG_DEFAULT_SBOX)) != 0
+		|| nr < 4 || len != schedule_blob_size(nr, flags)) {
+		return NULL;
+	}
+	// Only the complement S-box can be compiled
+	if ((flags & SCHEDULE_FLAG_COMPILED) && !(flags & SCHEDULE_FLAG_DEFAULT_SBOX)) {
+		return NULL;
+	}
+
+	// pIndex must be a permutation and a custom S-box a bijection
+	const unsigned char* subkeys = blob + SCHEDULE_HEADER_LEN + KEY_LEN;
+	const unsigned char* perm = subkeys + (nr + 1) * BLOCK_LEN;
+	bool seen[SBOX_SIZE] = {false};
+	for (int i = 0; i < BLOCK_LEN; i++) {
+		if (perm[i] >= BLOCK_LEN || seen[perm[i]]) { return NULL; }
+		seen[perm[i]] = true;
+	}
+	if (!(flags & SCHEDULE_FLAG_DEFAULT_SBOX)) {
+		const unsigned char* sbox = perm + BLOCK_LEN;
+		bool used[SBOX_SIZE] = {false};
+		for (int x = 0; x < SBOX_SIZE; x++) {
+			if (used[sbox[x]]) { return NULL; }
+			used[sbox[x]] = true;
+		}
+	}
+
+	// The subkeys and compiled key are rebuilt from the key, and the blob's
+	// copies must agree with them
+	SPN* spn = new SPN(blob);
+	bool ok = true;
+	for (int r = 0; ok && r < nr + 1; r++) {
+		ok = memcmp(spn->subkeys[r], subkeys + r * BLOCK_LEN, BLOCK_LEN) == 0;
+	}
+	if (ok && (flags & SCHEDULE_FLAG_COMPILED)) {
+		const unsigned char* c = perm + BLOCK_LEN;
+		ok = memcmp(spn->cPerm, c, BLOCK_LEN) == 0
+			&& memcmp(spn->cMask, c + BLOCK_LEN, BLOCK_LEN) == 0
+			&& memcmp(spn->cPermInverse, c + 2 * BLOCK_LEN, BLOCK_LEN) == 0
+			&& memcmp(spn->cMaskInverse, c + 3 * BLOCK_LEN, BLOCK_LEN) == 0;
+	}
+	if (!ok) {
+		delete spn;
+		return NULL;
+	}
+	return spn;
+}
+
+// Used by import_schedule() on a blob whose layout it has already validated
+SPN::SPN(const unsigned char blob[]) {
+	int flags = blob[5];
+	init(blob[6] | (blob[7] << 8));
+	verbose = false;
+	const unsigned char* p = blob + SCHEDULE_HEADER_LEN;
+
+	key = new unsigned char[KEY_LEN];
+	memcpy(key, p, KEY_LEN);
+	p += KEY_LEN + (numRounds + 1) * BLOCK_LEN;
+	generate_subkeys();
+
+	set_permutation(p);
+	p += BLOCK_LEN;
+
+	if (!(flags & SCHEDULE_FLAG_DEFAULT_SBOX)) {
+		complementSbox = false;
+		for (int x = 0; x < SBOX_SIZE; x++) {
+			sBox[x] = p[x];
+			sBoxInverse[p[x]] = (unsigned char) x;
+		}
+	}
+	setup_kernels();
+
+	if (flags & SCHEDULE_FLAG_COMPILED) { compile_key(); }
+}
+
+int SPN::get_num_rounds() const {
+	return numRounds;
+}
+
+void SPN::get_sbox(unsigned char sbox[SBOX_SIZE]) const {
+	memcpy(sbox, sBox, SBOX_SIZE);
+}
+
+void SPN::get_permutation(unsigned char perm[BLOCK_LEN]) const {
+	memcpy(perm, pIndex, BLOCK_LEN);
+}
+
+void SPN::get_subkey(int r, unsigned char out[BLOCK_LEN]) const {
+	memcpy(out, subkeys[r], BLOCK_LEN);
+}
+
+bool SPN::get_compiled_key(bool encrypt, unsigned char perm[BLOCK_LEN],
+						   unsigned char mask[BLOCK_LEN]) const {
+	if (!compiled) { return false; }
+	memcpy(perm, encrypt ? cPerm : cPermInverse, BLOCK_LEN);
+	memcpy(mask, encrypt ? cMask : cMaskInverse, BLOCK_LEN);
+	return true;
+}
+
 //**************************************************
 // Input processor: Turn array input into a 2D array of BLOCK_LEN sub-arrays
 //**************************************************
 void SPN::prepare_string_ECB_mode(const unsigned char input[],
 								  unsigned char in[][BLOCK_LEN], int len) {
-	int row = 0, currIndex = 0;
-	
-	// Process string input into unsigned char array for encryption; 
-	for (int i = 0; i < len; i++) {
-		if (i % BLOCK_LEN == 0) { currIndex = 0; }
-		else { currIndex++;	}
-		row = (int) i / BLOCK_LEN;
-		in[row][currIndex] = input[i];
+	SPN_STAT_TIME(prepareCycles);
+	int numFull = len / BLOCK_LEN;
+	for (int row = 0; row < numFull; row++) {
+		memcpy(in[row], input + row * BLOCK_LEN, BLOCK_LEN);
 	}
 	// Pad the last substring with 0's if needed
 	if (len % BLOCK_LEN != 0) {
-		for (int i = len % BLOCK_LEN; i < BLOCK_LEN; i++) { 
-			in[(int) len / BLOCK_LEN][i] = (unsigned char) 0;
-		}
+		memcpy(in[numFull], input + numFull * BLOCK_LEN, len % BLOCK_LEN);
+		memset(in[numFull] + len % BLOCK_LEN, 0, BLOCK_LEN - len % BLOCK_LEN);
 	}
 }
 void SPN::prepare_string_ECB_mode(const unsigned char input[],
 								  unsigned char **in, int len) {
-	int row = 0, currIndex = 0;
-	
-	// Process string input into unsigned char array for encryption; 
-	for (int i = 0; i < len; i++) {
-		if (i % BLOCK_LEN == 0) { currIndex = 0; }
-		else { currIndex++;	}
-		row = (int) i / BLOCK_LEN;
-		in[row][currIndex] = input[i];
+	SPN_STAT_TIME(prepareCycles);
+	int numFull = len / BLOCK_LEN;
+	for (int row = 0; row < numFull; row++) {
+		memcpy(in[row], input + row * BLOCK_LEN, BLOCK_LEN);
 	}
 	// Pad the last substring with 0's if needed
 	if (len % BLOCK_LEN != 0) {
-		for (int i = len % BLOCK_LEN; i < BLOCK_LEN; i++) { 
-			in[(int) len / BLOCK_LEN][i] = (unsigned char) 0;
-		}
+		memcpy(in[numFull], input + numFull * BLOCK_LEN, len % BLOCK_LEN);
+		memset(in[numFull] + len % BLOCK_LEN, 0, BLOCK_LEN - len % BLOCK_LEN);
 	}
 }
 
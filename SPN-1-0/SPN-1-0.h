@@ -10,6 +10,10 @@
 
 #include <iostream>
 #include <string>
+#include <cstddef>
+#include <stdint.h>
+#include <functional>
+#include "SPN-1-0-stats.h"
 
 using namespace std;
 
@@ -18,6 +22,54 @@ using namespace std;
 #define BLOCK_LEN 8 // 8 bytes = 64 bits, the usual block length of modern block ciphers.
 #define PERMUTATION_ENCRYPT_MODE true
 #define PERMUTATION_DECRYPT_MODE false
+#define SUBSTITUTION_ENCRYPT_MODE true
+#define SUBSTITUTION_DECRYPT_MODE false
+#define SBOX_SIZE 256
+#define SPN_SCHEDULE_VERSION 1 // layout version of export_schedule() blobs
+#define SPN_CHUNK_BYTES (32 * 1024) // work unit handed to a worker: about one L1 cache
+#define SPN_PARALLEL_THRESHOLD (256 * 1024) // below this many bytes stay single-threaded
+#define SPN_CTR_BATCH 512 // counter blocks encrypted per keystream batch
+
+class SPN_ThreadPool;
+class SPN_BlockKernel;
+
+// Observer for the intermediate values of the reference (scalar) path, used
+// for debugging and teaching. With no tracer installed the trace points are
+// compiled out of the round loop entirely.
+class SPN_Tracer {
+
+public:
+
+	virtual ~SPN_Tracer() {}
+
+	// A block enters SPN_encrypt() (encrypt = true) or SPN_decrypt()
+	virtual void begin_block(bool encrypt) = 0;
+
+	// Value after a stage ("XORed", "subs", "perm", "Whitening",
+	// "De-Whitening") of round r
+	virtual void trace(const char* stage, int r, const unsigned char block[BLOCK_LEN]) = 0;
+};
+
+// Block kernels that can run behind encrypt_blocks()/decrypt_blocks()
+enum SPN_Kernel {
+	SPN_KERNEL_AUTO,	// pick the fastest kernel available
+	SPN_KERNEL_SCALAR,	// reference round-by-round implementation
+	SPN_KERNEL_SIMD,	// SSSE3/AVX2 byte-shuffle kernel (if compiled in)
+	SPN_KERNEL_COLLAPSED,	// all rounds folded into one permutation + XOR mask
+	SPN_KERNEL_FIXED,	// SPN_Static instantiation for 4, 8 or 16 rounds
+	SPN_KERNEL_TTABLE,	// fused S+P lookup tables, works with any S-box
+	SPN_KERNEL_BITSLICE	// 64 blocks at a time as bit planes, any S-box, no table lookups
+};
+
+// Instruction sets the SIMD and collapsed kernels are built for. The best
+// one the CPU supports is used unless the SPN_ISA environment variable
+// names another (scalar, ssse3, avx2, avx512).
+enum SPN_Isa {
+	SPN_ISA_SCALAR,	// no SIMD: those blocks go to the portable kernels
+	SPN_ISA_SSSE3,	// 2 blocks per register
+	SPN_ISA_AVX2,	// 4 blocks per register
+	SPN_ISA_AVX512	// 8 blocks per register (AVX-512BW)
+};
 
 class SPN {
 
@@ -25,6 +77,20 @@ public:
 
 	// Default constructor: Random key, min# of rounds = 4
 	SPN(int nr = 4);
+
+	// Explicit key: the permutation for pi_P() is derived from seed, so two
+	// processes given the same (k, seed, nr) build the same cipher. Silent.
+	SPN(const unsigned char k[KEY_LEN], unsigned int seed, int nr = 4);
+
+	// Explicit key and explicit pi_P() given as gather indices:
+	// permuted[i] = input[perm[i]]. Silent.
+	SPN(const unsigned char k[KEY_LEN], const unsigned char (&perm)[BLOCK_LEN], int nr = 4);
+
+	// Rebuild an SPN from an export_schedule() blob without re-running the
+	// permutation generator. Returns NULL if the blob is malformed: unknown
+	// flags, a wrong length, or subkeys or a compiled key that don't follow
+	// from its key. The caller deletes the result.
+	static SPN* import_schedule(const unsigned char blob[], size_t len);
 	
 	// Destructor
 	~SPN();
@@ -35,6 +101,109 @@ public:
 	// Decryption for an array of ciphertext characters
 	unsigned char* decrypt_ECB_mode(const unsigned char ciphertext[], int len);
 
+	// ECB with PKCS#7 padding, so that decryption returns exactly the original
+	// bytes: 1 to BLOCK_LEN bytes, each holding the pad length, are appended.
+	// outLen receives the length of the result. Decryption returns NULL and
+	// outLen = -1 if len is not a positive multiple of BLOCK_LEN or the
+	// padding is malformed (wrong key or corrupted ciphertext).
+	unsigned char* encrypt_ECB_mode(const unsigned char plaintext[], int len, int& outLen);
+	unsigned char* decrypt_ECB_mode(const unsigned char ciphertext[], int len, int& outLen);
+
+	// CBC mode with initialization vector iv. Encryption is serial and pads
+	// the last block with 0's like ECB; decryption runs every block through
+	// the (parallel) block kernel and then XORs with the previous ciphertext.
+	unsigned char* encrypt_CBC_mode(const unsigned char plaintext[], int len,
+		const unsigned char iv[BLOCK_LEN]);
+	unsigned char* decrypt_CBC_mode(const unsigned char ciphertext[], int len,
+		const unsigned char iv[BLOCK_LEN]);
+
+	// Counter (CTR) mode: out = in XOR keystream, for the len bytes that start
+	// at byte offset of the stream. Keystream block i is the encryption of
+	// (nonce || counter + i), both 32-bit big-endian, so one nonce covers 2^32
+	// blocks. No padding: len is arbitrary, and any range can be processed on
+	// its own without touching earlier blocks. Decryption is the same operation.
+	void encrypt_CTR_mode(const unsigned char in[], unsigned char out[], size_t len,
+		uint32_t nonce, uint32_t counter = 0, uint64_t offset = 0);
+	void decrypt_CTR_mode(const unsigned char in[], unsigned char out[], size_t len,
+		uint32_t nonce, uint32_t counter = 0, uint64_t offset = 0);
+
+	// Bulk block API: encrypt/decrypt nblocks contiguous blocks of BLOCK_LEN
+	// bytes from in to out. Works entirely on caller-provided memory and stack
+	// scratch, so no heap allocation happens per call. in and out may alias.
+	void encrypt_blocks(const unsigned char in[], unsigned char out[], size_t nblocks);
+	void decrypt_blocks(const unsigned char in[], unsigned char out[], size_t nblocks);
+
+	// Parallel mode: run bulk blocks on a persistent pool of n threads
+	// (n = 0 picks one per core, n = 1 turns the pool off)
+	void set_num_threads(int n);
+
+	// Parallel mode on a pool owned by the caller, which may share it among
+	// several SPNs used from one thread at a time (NULL turns the pool off).
+	// The pool must outlive its use by this SPN.
+	void set_pool(SPN_ThreadPool* shared);
+
+	// Inputs smaller than this many bytes are processed on the calling thread
+	void set_parallel_threshold(size_t bytes);
+
+	// Run body(begin, end) over [0, count) in chunks of chunkSize on the
+	// pool, or on the calling thread if parallel mode is off. For callers
+	// that split work of their own (image tiles, analysis batches).
+	void parallel_for(size_t count, size_t chunkSize,
+		const function<void(size_t, size_t)>& body);
+
+	// Select the kernel used by encrypt_blocks()/decrypt_blocks()
+	void set_kernel(SPN_Kernel k);
+
+	// Instruction set of the SIMD kernels, shared by all SPN objects of the
+	// process. set_isa() returns false if the CPU lacks isa; switch only
+	// while no thread is encrypting.
+	static SPN_Isa get_isa();
+	static bool set_isa(SPN_Isa isa);
+	static const char* isa_name(SPN_Isa isa);
+
+	// Instrumentation (see SPN-1-0-stats.h): current counters, the same as a
+	// JSON object, and a reset to zero. Without SPN_STATS all counters are 0.
+	SPN_Stats stats_snapshot() const;
+	string stats_json() const;
+	void reset_stats();
+
+	// Report every intermediate value to tracer (NULL turns tracing off).
+	// While a tracer is installed, blocks go through the scalar path serially.
+	void set_tracer(SPN_Tracer* t);
+
+	// Replace the S-box of pi_S() (default: bitwise complement). The inverse for
+	// decryption is derived here. Returns false if sbox is not a bijection.
+	// SIMD, collapsed and fixed kernels rely on the complement S-box, so with
+	// any other S-box blocks go through the T-table kernel (or the bitsliced
+	// one, if selected) instead.
+	bool set_sbox(const unsigned char sbox[SBOX_SIZE]);
+
+	// Key precompilation: fold subkeys, pi_S() and pi_P() of all rounds into
+	// one byte permutation plus one XOR mask per direction. Afterwards blocks
+	// cost O(1) regardless of numRounds. Only possible with the complement
+	// S-box; does nothing otherwise.
+	void compile_key();
+
+	// Expanded state as a compact binary blob: key, subkeys, pi_P(), S-box
+	// (unless it is the default) and the compiled key if present.
+	// schedule_size() bytes are written to blob.
+	size_t schedule_size() const;
+	void export_schedule(unsigned char blob[]) const;
+
+	// Public design of the cipher, what a cryptanalyst is assumed to know:
+	// round count, S-box, and pi_P() in the form the constructor takes
+	int get_num_rounds() const;
+	void get_sbox(unsigned char sbox[SBOX_SIZE]) const;
+	void get_permutation(unsigned char perm[BLOCK_LEN]) const;
+
+	// Subkey r for 0 <= r <= numRounds (numRounds is the whitening key)
+	void get_subkey(int r, unsigned char out[BLOCK_LEN]) const;
+
+	// The compiled key of one direction (see compile_key()): block byte i is
+	// input byte perm[i] XOR mask[i]. Returns false if the key isn't compiled.
+	bool get_compiled_key(bool encrypt, unsigned char perm[BLOCK_LEN],
+		unsigned char mask[BLOCK_LEN]) const;
+
 	// print an unsigned char array as hexadecimal values
 	void printArray(const unsigned char in[], int len);
 
@@ -47,11 +216,44 @@ public:
 private:
 	
 	int numRounds;	
+	bool verbose; // print key material while setting up
 	unsigned char* key; // default length = KEY_LEN
 	unsigned char** subkeys; // there are (numRounds + 1) subkeys of length KEY_LEN
 	int pMatrix[BLOCK_LEN][BLOCK_LEN]; // matrix for pi_P()
 	int pMatrixInverse[BLOCK_LEN][BLOCK_LEN]; // inverse matrix of pi_P()
+	unsigned char pIndex[BLOCK_LEN]; // pi_P() as a gather: permuted[i] = input[pIndex[i]]
+	unsigned char pIndexInverse[BLOCK_LEN]; // gather indices of the inverse of pi_P()
+	SPN_Kernel kernel; // kernel used for bulk blocks
+	bool compiled; // true once compile_key() has run
+	SPN_ThreadPool* pool; // NULL unless parallel mode is on
+	bool ownsPool; // pool came from set_num_threads(), not set_pool()
+	SPN_BlockKernel* fixedKernel; // compile-time specialized kernel, NULL if none fits
+	SPN_Tracer* tracer; // NULL unless tracing
+#ifdef SPN_STATS
+	SPN_Counters stats;
+#endif
+	size_t parallelThreshold; // bytes
+	unsigned char sBox[SBOX_SIZE]; // pi_S()
+	unsigned char sBoxInverse[SBOX_SIZE]; // inverse of pi_S()
+	bool complementSbox; // sBox is the bitwise complement, so the cipher is affine
+	uint64_t (*tTable)[SBOX_SIZE]; // pi_P(pi_S()) of byte j, see update_ttables(); NULL when unused
+	uint64_t (*tTableInverse)[SBOX_SIZE]; // undoes pi_P() then pi_S() for byte i
+	uint64_t sBoxAnf[8][SBOX_SIZE / 64]; // monomials of each output bit of pi_S(), see generate_anf()
+	uint64_t sBoxInverseAnf[8][SBOX_SIZE / 64]; // the same for the inverse S-box
+	uint64_t* shuffleKeys; // numRounds folded keys of the SIMD kernel, encryption
+	uint64_t* shuffleKeysInverse; // the same for decryption
+	unsigned char cPerm[BLOCK_LEN], cMask[BLOCK_LEN]; // compiled encryption
+	unsigned char cPermInverse[BLOCK_LEN], cMaskInverse[BLOCK_LEN]; // compiled decryption
 	
+	// Shared constructor setup: round count and engine defaults
+	void init(int nr);
+
+	// Used by import_schedule() on a blob whose layout it has already validated
+	SPN(const unsigned char blob[]);
+
+	// Build the kernels that depend on subkeys and pi_P()
+	void setup_kernels();
+
 	// Key schedule: populate 2-D array subkeys from key
 	void generate_subkeys();
 
@@ -60,19 +262,75 @@ private:
 		int numSubkey);
 	
 	// Substitution pi_S()
-	void pi_S(const unsigned char* input, unsigned char substituted[]);
+	void pi_S(const unsigned char* input, unsigned char substituted[], bool encrypt);
+
+	// Fused S+P tables for the T-table kernel: built if the S-box and kernel
+	// choice can lead there, freed otherwise (32 KB). rebuild forces new
+	// contents after the S-box changed.
+	void update_ttables(bool rebuild = false);
+
+	// Algebraic normal form of the S-boxes for the bitsliced kernel
+	void generate_anf();
 
 	// Permutation pi_P()
 	void pi_P(const unsigned char* input, unsigned char permuted[], bool encrypt);
 
 	// Permutation matrix generator for pi_P()
-	void generate_permutation_matrix();
+	void generate_permutation_matrix(unsigned int seed);
+
+	// Fill pMatrix, pMatrixInverse and the gather indices from perm
+	void set_permutation(const unsigned char perm[BLOCK_LEN]);
+
+	// Encrypt Algorithm: one block from in to out (in and out may alias).
+	// Trace is a tracing policy; see SPN_NoTrace in SPN-1-0.cpp.
+	template <class Trace>
+	void SPN_encrypt(const unsigned char in[BLOCK_LEN], unsigned char out[BLOCK_LEN],
+		Trace& trace);
+
+	// Decrypt Algorithm: one block from in to out (in and out may alias)
+	template <class Trace>
+	void SPN_decrypt(const unsigned char in[BLOCK_LEN], unsigned char out[BLOCK_LEN],
+		Trace& trace);
+
+	// Whether a call on this many bytes should be spread over the pool
+	bool use_pool(size_t bytes) const;
+
+	// encrypt_blocks()/decrypt_blocks() without the byte count, for the ECB
+	// modes, which count the caller's bytes rather than the padded blocks
+	void encrypt_bulk(const unsigned char in[], unsigned char out[], size_t nblocks);
+	void decrypt_bulk(const unsigned char in[], unsigned char out[], size_t nblocks);
+
+	// Serial body of encrypt_blocks()/decrypt_blocks()
+	void encrypt_range(const unsigned char in[], unsigned char out[], size_t nblocks);
+	void decrypt_range(const unsigned char in[], unsigned char out[], size_t nblocks);
+
+	// CBC decryption of blocks [begin, end) of ciphertext
+	void CBC_decrypt_range(const unsigned char ciphertext[], unsigned char plaintext[],
+		size_t begin, size_t end, const unsigned char iv[BLOCK_LEN]);
+
+	// Serial CTR over the stream bytes [offset, offset + len)
+	void CTR_range(const unsigned char in[], unsigned char out[], size_t len,
+		uint32_t nonce, uint32_t counter, uint64_t offset);
+
+	// SIMD kernels: process as many leading blocks as fit in whole registers
+	// of the active instruction set and return how many blocks were done.
+	// The caller finishes the rest.
+	size_t SPN_encrypt_simd(const unsigned char in[], unsigned char out[], size_t nblocks);
+	size_t SPN_decrypt_simd(const unsigned char in[], unsigned char out[], size_t nblocks);
+
+	// T-table kernel: each round is BLOCK_LEN lookups and XORs
+	void SPN_encrypt_ttable(const unsigned char in[], unsigned char out[], size_t nblocks);
+	void SPN_decrypt_ttable(const unsigned char in[], unsigned char out[], size_t nblocks);
 
-	// Encrypt Algorithm
-	unsigned char* SPN_encrypt(const unsigned char in[BLOCK_LEN]);
+	// Bitsliced kernel: 64 blocks are transposed into 64 bit planes, so the
+	// key XOR is one XOR per plane, pi_S() is a Boolean circuit over 8
+	// planes and pi_P() only renames planes
+	void SPN_encrypt_bitslice(const unsigned char in[], unsigned char out[], size_t nblocks);
+	void SPN_decrypt_bitslice(const unsigned char in[], unsigned char out[], size_t nblocks);
 
-	// Decrypt Algorithm
-	unsigned char* SPN_decrypt(const unsigned char in[BLOCK_LEN]);
+	// Compiled (collapsed) kernel: out[i] = in[perm[i]] ^ mask[i] for each block
+	void SPN_collapsed(const unsigned char in[], unsigned char out[], size_t nblocks,
+		const unsigned char perm[BLOCK_LEN], const unsigned char mask[BLOCK_LEN]);
 };
 
 #endif
@@ -1 +1,7 @@
-g++ -I/usr/local/include/opencv -I/usr/local/include/opencv2 -L/usr/local/lib/ -g -w -o SPN SPN-1-0-test.cpp SPN-1-0.cpp SPN-1-0-debug.cpp -lopencv_core -lopencv_imgproc -lopencv_highgui -lopencv_ml -lopencv_video -lopencv_features2d -lopencv_calib3d -lopencv_objdetect -lopencv_contrib -lopencv_legacy -lopencv_stitching
+g++ -I/usr/local/include/opencv -I/usr/local/include/opencv2 -L/usr/local/lib/ -std=c++11 -pthread -g -O2 -w -o SPN SPN-1-0-test.cpp SPN-1-0.cpp SPN-1-0-debug.cpp SPN-1-0-pool.cpp SPN-1-0-image.cpp SPN-1-0-corpus.cpp SPN-1-0-analysis.cpp SPN-1-0-reader.cpp SPN-1-0-batch.cpp SPN-1-0-keycache.cpp SPN-1-0-stream.cpp SPN-1-0-client.cpp -lopencv_core -lopencv_imgproc -lopencv_highgui -lopencv_ml -lopencv_video -lopencv_features2d -lopencv_calib3d -lopencv_objdetect -lopencv_contrib -lopencv_legacy -lopencv_stitching
+g++ -std=c++11 -pthread -g -O2 -w -o SPN-file SPN-1-0-file.cpp SPN-1-0-stream.cpp SPN-1-0.cpp SPN-1-0-pool.cpp
+g++ -std=c++11 -pthread -g -O2 -w -o SPN-bench SPN-1-0-bench.cpp SPN-1-0.cpp SPN-1-0-pool.cpp
+g++ -std=c++11 -pthread -g -O2 -w -o SPN-attack SPN-1-0-attack.cpp SPN-1-0-analysis.cpp SPN-1-0-corpus.cpp SPN-1-0.cpp SPN-1-0-pool.cpp
+g++ -std=c++11 -pthread -g -O2 -w -o SPN-daemon SPN-1-0-daemon.cpp SPN-1-0-client.cpp SPN-1-0.cpp SPN-1-0-pool.cpp
+g++ -std=c++11 -pthread -g -O2 -w -o SPN-load SPN-1-0-load.cpp SPN-1-0-client.cpp
+g++ -I/usr/local/include/opencv -I/usr/local/include/opencv2 -L/usr/local/lib/ -std=c++11 -pthread -g -O2 -w -DSPN_STATS -o SPN-stats SPN-1-0-test.cpp SPN-1-0.cpp SPN-1-0-debug.cpp SPN-1-0-pool.cpp SPN-1-0-image.cpp SPN-1-0-corpus.cpp SPN-1-0-analysis.cpp SPN-1-0-reader.cpp SPN-1-0-batch.cpp SPN-1-0-keycache.cpp SPN-1-0-stream.cpp SPN-1-0-client.cpp -lopencv_core -lopencv_imgproc -lopencv_highgui -lopencv_ml -lopencv_video -lopencv_features2d -lopencv_calib3d -lopencv_objdetect -lopencv_contrib -lopencv_legacy -lopencv_stitching